@@ -7,6 +7,9 @@
 #include "threads/interrupt.h"
 #include "threads/synch.h"
 #include "threads/thread.h"
+#ifdef FILESYS
+#include "filesys/cache.h"
+#endif
 
 /* See [8254] for hardware details of the 8254 timer chip. */
 
@@ -172,6 +175,9 @@ timer_interrupt (struct intr_frame *args UNUSED)
 {
   ticks++;
   thread_tick ();
+#ifdef FILESYS
+  cache_tick (ticks);
+#endif
 }
 
 /* Returns true if LOOPS iterations waits for more than one timer
@@ -5,13 +5,17 @@
    named.
 
    By default, only the name of each file is printed.  If "-l" is
-   given as the first argument, the type, size, and inumber of
-   each file is also printed.  This won't work until project 4. */
+   given as the first argument, the type, size, inumber, and
+   sectors allocated of each file are also printed.  This won't
+   work until project 4. */
 
 #include <syscall.h>
 #include <stdio.h>
 #include <string.h>
 
+/* Directory entries read by each getdents() call. */
+#define ENTRY_BATCH 16
+
 static bool
 list_dir (const char *dir, bool verbose)
 {
@@ -24,38 +28,49 @@ list_dir (const char *dir, bool verbose)
 
   if (isdir (dir_fd))
     {
-      char name[READDIR_MAX_LEN];
+      struct dirent entries[ENTRY_BATCH];
+      int cnt;
 
       printf ("%s", dir);
       if (verbose)
-        printf (" (inumber %d)", inumber (dir_fd));
+        {
+          struct stat st;
+          if (fstat (dir_fd, &st))
+            printf (" (inumber %d)", st.inumber);
+        }
       printf (":\n");
 
-      while (readdir (dir_fd, name))
+      while ((cnt = getdents (dir_fd, entries, ENTRY_BATCH)) > 0)
         {
-          printf ("%s", name);
-          if (verbose)
-            {
-              char full_name[128];
-              int entry_fd;
+          int i;
 
-              snprintf (full_name, sizeof full_name, "%s/%s", dir, name);
-              entry_fd = open (full_name);
+          for (i = 0; i < cnt; i++)
+            {
+              struct dirent *e = &entries[i];
 
-              printf (": ");
-              if (entry_fd != -1)
+              printf ("%s", e->name);
+              if (verbose)
                 {
-                  if (isdir (entry_fd))
-                    printf ("directory");
+                  char full_name[128];
+                  struct stat st;
+
+                  snprintf (full_name, sizeof full_name, "%s/%s",
+                            dir, e->name);
+                  printf (": ");
+                  if (stat (full_name, &st))
+                    {
+                      if (st.isdir)
+                        printf ("directory");
+                      else
+                        printf ("%d-byte file", st.length);
+                      printf (", inumber %d, %d sectors",
+                              st.inumber, st.blocks);
+                    }
                   else
-                    printf ("%d-byte file", filesize (entry_fd));
-                  printf (", inumber %d", inumber (entry_fd));
+                    printf ("stat failed");
                 }
-              else
-                printf ("open failed");
-              close (entry_fd);
+              printf ("\n");
             }
-          printf ("\n");
         }
     }
   else
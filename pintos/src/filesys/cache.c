@@ -0,0 +1,724 @@
+#include "filesys/cache.h"
+#include <debug.h>
+#include <hash.h>
+#include <round.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "filesys/filesys.h"
+#include "filesys/journal.h"
+#include "threads/interrupt.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+
+/* Number of independently locked partitions of the buffer cache.
+   A sector always lives in partition cache_partition_of (sector). */
+#define CACHE_PARTITIONS 8
+
+/* Fewest sectors each partition may hold. */
+#define MIN_PARTITION_SIZE 2
+
+/* Usage count given to a data sector when it is used.  A sector
+   that is read once during a large scan is evicted on the next
+   pass of the clock hand. */
+#define DATA_USAGE 1
+
+/* Usage count given to an inode or pointer sector when it is used.
+   These survive several passes of the clock hand, so sequential
+   scans through data sectors do not push them out. */
+#define METADATA_USAGE 3
+
+/* Usage count given to a sector brought in by read-ahead.  It
+   reaches DATA_USAGE once it is actually read, so read-ahead that
+   turns out to be wasted is the first thing evicted. */
+#define PREFETCH_USAGE 0
+
+/* Owner of a sector that is not file data. */
+#define NO_OWNER ((block_sector_t) -1)
+
+/* A sector held in the buffer cache.
+
+   sector_idx, valid and the membership of the entry in its
+   partition index are only changed while holding both the
+   partition's lock and sector_lock, so holding either one is
+   enough to read them.  data and dirty are protected by
+   sector_lock, usage by the partition's lock. */
+struct cached_sector {
+	block_sector_t sector_idx; // key of this entry in the partition index
+	bool valid; // false until the entry holds a sector
+	struct hash_elem hash_elem; // element in partition index
+	int usage; // clock reference count, evicted when it reaches 0
+	bool dirty;
+	int64_t dirty_since; // timer tick at which dirty was last set
+	bool journal_pending; // changed through a pin inside a journal handle
+	block_sector_t owner; // inode sector of the file whose data was last written here
+	bool writeback; // old contents are being written back to writeback_sector
+	block_sector_t writeback_sector;
+	struct lock sector_lock; // acquire if currently reading/writing to this sector
+	char *data; // of size BLOCK_SECTOR_SIZE, could be inodedisk or data block, up to caller to cast to correct one
+};
+
+/* A partition of the buffer cache.  Hits and misses on sectors in
+   different partitions never touch the same lock, and no
+   partition lock is held across device I/O. */
+struct cache_partition {
+	struct lock lock; // protects the fields below
+	struct hash index; // maps sector_idx to cached_sector
+	size_t hand; // next entry the clock looks at for eviction
+	int writeback_cnt; // entries with writeback set
+	unsigned long long hit_cnt; // lookups that found their sector
+	unsigned long long miss_cnt; // lookups that had to load their sector
+	unsigned long long writeback_total; // dirty sectors written on eviction
+	struct cached_sector *entries; // this partition's slice of cache_entries
+};
+
+size_t cache_size = CACHE_DEFAULT_SIZE;
+
+/* Sectors held by each partition. */
+static size_t partition_size;
+
+static struct cache_partition partitions[CACHE_PARTITIONS];
+
+/* Every cached_sector, partition by partition, and the sector
+   data they point into.  Both are allocated once, from contiguous
+   kernel pages, when the cache is initialized. */
+static struct cached_sector *cache_entries;
+static char *cache_data;
+
+/* Write-behind.  The flusher thread writes dirty sectors back in
+   batches when it is woken, which happens every FLUSH_INTERVAL
+   timer ticks and whenever the number of dirty sectors reaches
+   the high watermark. */
+#define FLUSH_INTERVAL (TIMER_FREQ / 4)
+
+/* Most sectors the flusher writes between checks of the cache. */
+#define FLUSH_BATCH 32
+
+int64_t cache_flush_age = 3 * TIMER_FREQ;
+int cache_flush_high = 50;
+
+static struct semaphore flush_wakeup; // upped to wake the flusher
+static bool flush_requested; // flush_wakeup has been upped and not yet downed
+static bool flusher_started;
+
+static struct lock dirty_lock; // protects dirty_cnt
+static size_t dirty_cnt; // dirty entries in the cache
+
+static hash_hash_func cached_sector_hash;
+static hash_less_func cached_sector_less;
+static thread_func flusher;
+
+/* Initializes the buffer cache with room for cache_size sectors,
+   rounded up so that each partition holds the same number. */
+void
+cache_init (void)
+{
+  size_t entries_size, data_size;
+
+  partition_size = DIV_ROUND_UP (cache_size, CACHE_PARTITIONS);
+  if (partition_size < MIN_PARTITION_SIZE)
+    partition_size = MIN_PARTITION_SIZE;
+  cache_size = partition_size * CACHE_PARTITIONS;
+
+  entries_size = cache_size * sizeof *cache_entries;
+  data_size = cache_size * BLOCK_SECTOR_SIZE;
+  cache_entries = palloc_get_multiple (0, DIV_ROUND_UP (entries_size, PGSIZE));
+  cache_data = palloc_get_multiple (0, DIV_ROUND_UP (data_size, PGSIZE));
+  if (cache_entries == NULL || cache_data == NULL)
+    PANIC ("buffer cache: can't allocate %zu sectors", cache_size);
+
+  for (int i = 0; i < CACHE_PARTITIONS; i++) {
+    struct cache_partition *p = &partitions[i];
+    lock_init (&p->lock);
+    hash_init (&p->index, cached_sector_hash, cached_sector_less, NULL);
+    p->hand = 0;
+    p->writeback_cnt = 0;
+    p->hit_cnt = p->miss_cnt = p->writeback_total = 0;
+    p->entries = &cache_entries[i * partition_size];
+    for (size_t j = 0; j < partition_size; j++) {
+      struct cached_sector *cs = &p->entries[j];
+      cs->data = &cache_data[(i * partition_size + j) * BLOCK_SECTOR_SIZE];
+      cs->valid = false;
+      cs->usage = 0;
+      cs->dirty = false;
+      cs->writeback = false;
+      cs->journal_pending = false;
+      cs->owner = NO_OWNER;
+      lock_init (&cs->sector_lock);
+    }
+  }
+
+  lock_init (&dirty_lock);
+  dirty_cnt = 0;
+  sema_init (&flush_wakeup, 0);
+  flush_requested = false;
+}
+
+/* Starts the flusher thread, unless it is already running.  The
+   flusher commits old journal transactions, so this must not be
+   called until the journal has been initialized. */
+void
+cache_start_flusher (void)
+{
+  if (!flusher_started) {
+    flusher_started = thread_create ("cache-flush", PRI_DEFAULT, flusher, NULL) != TID_ERROR;
+  }
+}
+
+/* Returns the number of dirty sectors at which the flusher is
+   woken early. */
+static size_t
+dirty_high_watermark (void)
+{
+  return cache_size * cache_flush_high / 100;
+}
+
+/* Wakes the flusher thread unless it is already awake.
+   May be called from an interrupt handler. */
+static void
+wake_flusher (void)
+{
+  enum intr_level old_level = intr_disable ();
+  if (!flush_requested) {
+    flush_requested = true;
+    sema_up (&flush_wakeup);
+  }
+  intr_set_level (old_level);
+}
+
+/* Called by the timer interrupt handler on every tick NOW. */
+void
+cache_tick (int64_t now)
+{
+  if (flusher_started && now % FLUSH_INTERVAL == 0)
+    wake_flusher ();
+}
+
+/* Marks CS, whose sector_lock the caller holds, as dirty. */
+static void
+mark_dirty (struct cached_sector *cs)
+{
+  if (cs->dirty)
+    return;
+  cs->dirty = true;
+  cs->dirty_since = timer_ticks ();
+
+  lock_acquire (&dirty_lock);
+  bool wake = ++dirty_cnt >= dirty_high_watermark ();
+  lock_release (&dirty_lock);
+  if (wake)
+    wake_flusher ();
+}
+
+/* Marks CS, whose sector_lock the caller holds, as clean. */
+static void
+mark_clean (struct cached_sector *cs)
+{
+  if (!cs->dirty)
+    return;
+  cs->dirty = false;
+
+  lock_acquire (&dirty_lock);
+  dirty_cnt--;
+  lock_release (&dirty_lock);
+}
+
+/* Returns a hash value for the cached_sector containing E. */
+static unsigned
+cached_sector_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct cached_sector *cs = hash_entry (e, struct cached_sector, hash_elem);
+  return hash_int (cs->sector_idx);
+}
+
+/* Returns true if cached_sector A precedes cached_sector B. */
+static bool
+cached_sector_less (const struct hash_elem *a, const struct hash_elem *b,
+                    void *aux UNUSED)
+{
+  const struct cached_sector *cs_a = hash_entry (a, struct cached_sector, hash_elem);
+  const struct cached_sector *cs_b = hash_entry (b, struct cached_sector, hash_elem);
+  return cs_a->sector_idx < cs_b->sector_idx;
+}
+
+/* Returns the partition that caches SECTOR_IDX. */
+static struct cache_partition *
+cache_partition_of (block_sector_t sector_idx)
+{
+  return &partitions[hash_int (sector_idx) % CACHE_PARTITIONS];
+}
+
+/* Returns the cached_sector holding SECTOR_IDX in P, or a null
+   pointer if it is not cached.  Caller must hold P's lock. */
+static struct cached_sector *
+lookup_cached_sector (struct cache_partition *p, block_sector_t sector_idx)
+{
+  struct cached_sector key;
+  struct hash_elem *e;
+
+  key.sector_idx = sector_idx;
+  e = hash_find (&p->index, &key.hash_elem);
+  return e != NULL ? hash_entry (e, struct cached_sector, hash_elem) : NULL;
+}
+
+/* Returns the entry of P whose old contents are still being
+   written back to SECTOR_IDX, or a null pointer if there is
+   none.  Caller must hold P's lock. */
+static struct cached_sector *
+find_writeback (struct cache_partition *p, block_sector_t sector_idx)
+{
+  if (p->writeback_cnt == 0)
+    return NULL;
+  for (size_t i = 0; i < partition_size; i++)
+    if (p->entries[i].writeback && p->entries[i].writeback_sector == sector_idx)
+      return &p->entries[i];
+  return NULL;
+}
+
+/* Picks an entry of P to hold a new sector and returns it with
+   its sector_lock held, or returns a null pointer if every entry
+   is in use.  Empty entries are used first, then the clock hand
+   sweeps the partition, giving each entry one pass per unit of
+   usage before it is evicted.  On the first pass dirty entries
+   are left for the flusher, so that a miss can usually be served
+   without waiting for a write.  Caller must hold P's lock. */
+static struct cached_sector *
+choose_victim (struct cache_partition *p)
+{
+  for (size_t i = 0; i < partition_size; i++) {
+    struct cached_sector *cs = &p->entries[i];
+    if (!cs->valid && lock_try_acquire (&cs->sector_lock))
+      return cs;
+  }
+
+  for (size_t i = 0; i < partition_size * (METADATA_USAGE + 2); i++) {
+    struct cached_sector *cs = &p->entries[p->hand];
+    p->hand = (p->hand + 1) % partition_size;
+    if (cs->usage > 0)
+      cs->usage--;
+    else if (cs->dirty && i < partition_size)
+      wake_flusher ();
+    else if (lock_try_acquire (&cs->sector_lock))
+      return cs;
+  }
+  return NULL;
+}
+
+/* Gets the cached_sector for SECTOR_IDX from the buffer cache.
+   If sector_idx isnt present, then we evict a sector from its partition
+   by clock replacement and pull in sector_idx from disk.  During eviction, we
+   write back to disk using block_write if the dirty bit is true.
+   Disk accesses happen with only the sector's own lock held.
+   If IS_WRITE, the caller is about to overwrite the whole sector, so a miss
+   zeroes the data instead of reading it from disk.
+   The sector's clock usage is raised to at least USAGE.
+   Aquires the sectors lock and returns a pointer to the sector.
+   Callers of this function must release sectors lock after done using. */
+static struct cached_sector *
+get_cached_sector (block_sector_t sector_idx, bool is_write, int usage)
+{
+  struct cache_partition *p = cache_partition_of (sector_idx);
+  struct cached_sector *cs;
+
+  for (;;) {
+    lock_acquire (&p->lock);
+
+    cs = lookup_cached_sector (p, sector_idx);
+    if (cs != NULL) {
+      if (cs->usage < usage)
+        cs->usage = usage;
+      p->hit_cnt++;
+      lock_release (&p->lock);
+      lock_acquire (&cs->sector_lock);
+      // make sure that cs hasn't changed because of an eviction
+      if (cs->valid && cs->sector_idx == sector_idx)
+        return cs;
+      // if it has we need to look it up again to make sure it hasnt been pulled in since
+      lock_release (&cs->sector_lock);
+      continue;
+    }
+
+    // an older copy may still be on its way to disk, wait for it
+    cs = find_writeback (p, sector_idx);
+    if (cs == NULL) {
+      cs = choose_victim (p);
+      if (cs != NULL)
+        break;
+      // everything is in use, wait for the entry under the clock hand
+      cs = &p->entries[p->hand];
+    }
+    lock_release (&p->lock);
+    lock_acquire (&cs->sector_lock);
+    lock_release (&cs->sector_lock);
+  }
+
+  // didnt find item in buffer, reuse the victim for sector_idx.  A sector
+  // changed by the running journal transaction must not go home before it
+  // commits; the journal has its latest contents, so it is just dropped.
+  if (cs->valid)
+    hash_delete (&p->index, &cs->hash_elem);
+  if (cs->valid && cs->dirty && !journal_holds (cs->sector_idx)) {
+    cs->writeback = true;
+    cs->writeback_sector = cs->sector_idx;
+    p->writeback_cnt++;
+    p->writeback_total++;
+  }
+  cs->sector_idx = sector_idx;
+  cs->valid = true;
+  cs->usage = usage;
+  cs->owner = NO_OWNER;
+  hash_insert (&p->index, &cs->hash_elem);
+  p->miss_cnt++;
+  lock_release (&p->lock);
+
+  if (cs->writeback) { // we need to write back to disk
+    block_write (fs_device, cs->writeback_sector, cs->data);
+    lock_acquire (&p->lock);
+    cs->writeback = false;
+    p->writeback_cnt--;
+    lock_release (&p->lock);
+  }
+  mark_clean (cs);
+  if (is_write)
+    memset (cs->data, 0, BLOCK_SECTOR_SIZE);
+  else if (!journal_lookup (sector_idx, cs->data))
+    block_read (fs_device, sector_idx, cs->data);
+  return cs;
+}
+
+/* Prints buffer cache statistics. */
+void
+cache_print_stats (void)
+{
+  unsigned long long hits = 0, misses = 0, writebacks = 0;
+
+  for (int i = 0; i < CACHE_PARTITIONS; i++) {
+    struct cache_partition *p = &partitions[i];
+    lock_acquire (&p->lock);
+    hits += p->hit_cnt;
+    misses += p->miss_cnt;
+    writebacks += p->writeback_total;
+    lock_release (&p->lock);
+  }
+  printf ("Buffer cache: %llu hits, %llu misses, %llu evicted dirty sectors\n",
+          hits, misses, writebacks);
+}
+
+// Called from filesys_done.  Sectors held by the journal are left for it
+// to write.
+void
+write_all_dirty_sectors (void)
+{
+  for (size_t i = 0; i < cache_size; i++) {
+    struct cached_sector *cs = &cache_entries[i];
+    lock_acquire (&cs->sector_lock);
+    if (cs->valid && cs->dirty && !journal_holds (cs->sector_idx)) {
+      block_write (fs_device, cs->sector_idx, cs->data);
+      mark_clean (cs);
+    }
+    lock_release (&cs->sector_lock);
+  }
+}
+
+/* Returns true if cached_sector A has a lower sector number than
+   cached_sector B. */
+static int
+compare_sector_idx (const void *a_, const void *b_)
+{
+  const struct cached_sector *a = *(struct cached_sector * const *) a_;
+  const struct cached_sector *b = *(struct cached_sector * const *) b_;
+  return a->sector_idx < b->sector_idx ? -1 : a->sector_idx > b->sector_idx;
+}
+
+/* Writes back the CNT entries in BATCH, collected without
+   locking, in sector order.  Each is checked again once its lock
+   is held, and is skipped if it is no longer dirty or is held by
+   the journal.  Returns the number of sectors written. */
+static size_t
+write_batch (struct cached_sector **batch, size_t cnt)
+{
+  size_t written = 0;
+
+  qsort (batch, cnt, sizeof *batch, compare_sector_idx);
+  for (size_t i = 0; i < cnt; i++) {
+    struct cached_sector *cs = batch[i];
+    lock_acquire (&cs->sector_lock);
+    if (cs->valid && cs->dirty && !journal_holds (cs->sector_idx)) {
+      block_write (fs_device, cs->sector_idx, cs->data);
+      mark_clean (cs);
+      written++;
+    }
+    lock_release (&cs->sector_lock);
+  }
+  return written;
+}
+
+/* Writes back up to FLUSH_BATCH dirty sectors, in sector order,
+   scanning the cache from entry *START onward and advancing *START
+   past the entries scanned.  Sectors that have been dirty for less
+   than cache_flush_age ticks are only written if FORCE is true,
+   and sectors held by the journal are skipped, so that they do not
+   take up room in the batch.  Returns the number of sectors
+   written. */
+static size_t
+flush_batch (bool force, size_t *start)
+{
+  struct cached_sector *batch[FLUSH_BATCH];
+  int64_t now = timer_ticks ();
+  size_t cnt = 0;
+  size_t i;
+
+  for (i = *start; i < cache_size && cnt < FLUSH_BATCH; i++) {
+    struct cached_sector *cs = &cache_entries[i];
+    if (cs->valid && cs->dirty
+        && (force || now - cs->dirty_since >= cache_flush_age)
+        && !journal_holds (cs->sector_idx))
+      batch[cnt++] = cs;
+  }
+  *start = i;
+  return write_batch (batch, cnt);
+}
+
+/* Writes back the dirty data sectors of the file whose inode is
+   in INODE_SECTOR, and no others. */
+void
+cache_write_back_file (block_sector_t inode_sector)
+{
+  struct cached_sector *batch[FLUSH_BATCH];
+
+  for (size_t i = 0; i < cache_size; ) {
+    size_t cnt = 0;
+    for (; i < cache_size && cnt < FLUSH_BATCH; i++) {
+      struct cached_sector *cs = &cache_entries[i];
+      if (cs->valid && cs->dirty && cs->owner == inode_sector)
+        batch[cnt++] = cs;
+    }
+    write_batch (batch, cnt);
+  }
+}
+
+/* Flusher thread.  Each time it is woken, commits the journal
+   transaction if it has been open for cache_flush_age ticks,
+   writes back sectors that have been dirty that long, and if the
+   high watermark has been reached, writes back sectors
+   regardless of age until half that many remain dirty.  Each
+   makes one pass over the cache, a batch at a time. */
+static void
+flusher (void *aux UNUSED)
+{
+  for (;;) {
+    sema_down (&flush_wakeup);
+    flush_requested = false;
+
+    journal_commit_old (cache_flush_age);
+
+    size_t i = 0;
+    while (i < cache_size)
+      flush_batch (false, &i);
+    i = 0;
+    while (i < cache_size && dirty_cnt > dirty_high_watermark () / 2)
+      flush_batch (true, &i);
+  }
+}
+
+/* Copies SIZE bytes from BUFFER into the cached copy of
+   SECTOR_IDX, starting at SECTOR_OFS, and marks it dirty.  The
+   sector is data of the file whose inode is in OWNER, or is
+   metadata if OWNER is NO_OWNER, in which case the new contents
+   are logged in the running transaction if the current thread
+   has a journal handle open. */
+static void
+write_cached_sector (block_sector_t sector_idx, const void *buffer,
+                     size_t size, size_t sector_ofs, int usage,
+                     block_sector_t owner)
+{
+  ASSERT (sector_ofs + size <= BLOCK_SECTOR_SIZE);
+
+  /* A partial write must not clobber the rest of the sector. */
+  struct cached_sector *cs = get_cached_sector (sector_idx, size == BLOCK_SECTOR_SIZE,
+                                                usage);
+  memcpy (cs->data + sector_ofs, buffer, size);
+  mark_dirty (cs);
+  cs->owner = owner;
+  if (owner == NO_OWNER && journal_active ())
+    journal_log (sector_idx, cs->data);
+  lock_release (&cs->sector_lock);
+}
+
+/* Copies SIZE bytes of the cached copy of SECTOR_IDX, starting at
+   SECTOR_OFS, into BUFFER. */
+static void
+read_cached_sector (block_sector_t sector_idx, void *buffer,
+                    size_t size, size_t sector_ofs, int usage)
+{
+  ASSERT (sector_ofs + size <= BLOCK_SECTOR_SIZE);
+  struct cached_sector *cs = get_cached_sector (sector_idx, false, usage);
+  memcpy (buffer, cs->data + sector_ofs, size);
+  lock_release (&cs->sector_lock);
+}
+
+// writes buffer into c->data. buffer must be size SIZE.
+// Used for file data (e.g. inode_write_at), which is evicted before metadata
+// and is never journaled.  INODE_SECTOR is the file's inode, so that
+// cache_write_back_file can find the sector.
+void
+cache_write_with_size_and_offset (block_sector_t sector_idx, const void *buffer,
+                                  size_t size, size_t sector_ofs,
+                                  block_sector_t inode_sector)
+{
+  write_cached_sector (sector_idx, buffer, size, sector_ofs, DATA_USAGE,
+                       inode_sector);
+}
+
+// Like cache_write_with_size_and_offset, but for the contents of a
+// directory or the free map, which are journaled like inodes.
+void
+cache_write_metadata (block_sector_t sector_idx, const void *buffer,
+                      size_t size, size_t sector_ofs)
+{
+  write_cached_sector (sector_idx, buffer, size, sector_ofs, METADATA_USAGE,
+                       NO_OWNER);
+}
+
+// Writes a whole inode or pointer sector.  These are kept in the cache
+// longer than file data.
+void
+cache_write (block_sector_t sector_idx, const void *buffer)
+{
+  write_cached_sector (sector_idx, buffer, BLOCK_SECTOR_SIZE, 0, METADATA_USAGE,
+                       NO_OWNER);
+}
+
+// writes c->data into buffer. buffer must be atleast size SIZE.
+// Used for file data (e.g. inode_read_at), which is evicted before metadata.
+void
+cache_read_with_size_and_offset (block_sector_t sector_idx, void *buffer,
+                                 size_t size, size_t sector_ofs)
+{
+  read_cached_sector (sector_idx, buffer, size, sector_ofs, DATA_USAGE);
+}
+
+// Reads a whole inode or pointer sector.  These are kept in the cache
+// longer than file data.
+void
+cache_read (block_sector_t sector_idx, void *buffer)
+{
+  read_cached_sector (sector_idx, buffer, BLOCK_SECTOR_SIZE, 0, METADATA_USAGE);
+}
+
+// Pins SECTOR_IDX in the cache and returns its entry, for callers that
+// want to use the cached bytes in place instead of copying them.  No other
+// thread can read, write or evict the sector until it is passed to
+// cache_release, and the caller must not use the cache in any other way
+// while it holds it.  If OVERWRITE, the caller is about to replace the
+// whole sector, so a miss does not read it from disk.
+struct cached_sector *
+cache_acquire (block_sector_t sector_idx, bool overwrite)
+{
+  return get_cached_sector (sector_idx, overwrite, METADATA_USAGE);
+}
+
+// Returns the data of CS, which the caller has acquired, for reading.
+const void *
+cache_read_data (struct cached_sector *cs)
+{
+  ASSERT (lock_held_by_current_thread (&cs->sector_lock));
+  return cs->data;
+}
+
+// Returns the data of CS, which the caller has acquired, for writing,
+// and marks it dirty.  Pinned sectors are metadata, so if a journal handle
+// is open the new contents are logged when CS is released.
+void *
+cache_write_data (struct cached_sector *cs)
+{
+  ASSERT (lock_held_by_current_thread (&cs->sector_lock));
+  mark_dirty (cs);
+  cs->owner = NO_OWNER;
+  cs->journal_pending = journal_active ();
+  return cs->data;
+}
+
+// Unpins CS, which the caller has acquired.
+void
+cache_release (struct cached_sector *cs)
+{
+  if (cs->journal_pending) {
+    journal_log (cs->sector_idx, cs->data);
+    cs->journal_pending = false;
+  }
+  lock_release (&cs->sector_lock);
+}
+
+// Returns the entry caching SECTOR_IDX with its sector_lock held, or a
+// null pointer if the sector is not cached.  If an older copy of the
+// sector is being written back, waits for the write to finish.
+static struct cached_sector *
+lock_if_cached (block_sector_t sector_idx)
+{
+  struct cache_partition *p = cache_partition_of (sector_idx);
+
+  lock_acquire (&p->lock);
+  struct cached_sector *cs = lookup_cached_sector (p, sector_idx);
+  struct cached_sector *wb = cs == NULL ? find_writeback (p, sector_idx) : NULL;
+  lock_release (&p->lock);
+
+  if (wb != NULL) {
+    lock_acquire (&wb->sector_lock);
+    lock_release (&wb->sector_lock);
+  }
+  if (cs == NULL)
+    return NULL;
+  lock_acquire (&cs->sector_lock);
+  if (cs->valid && cs->sector_idx == sector_idx)
+    return cs;
+  lock_release (&cs->sector_lock);
+  return NULL;
+}
+
+// Writes SECTOR_IDX to disk now if it is cached and dirty.  Used by the
+// journal to write data before the metadata that points to it commits.
+void
+cache_write_back (block_sector_t sector_idx)
+{
+  struct cached_sector *cs = lock_if_cached (sector_idx);
+  if (cs != NULL) {
+    if (cs->dirty) {
+      block_write (fs_device, sector_idx, cs->data);
+      mark_clean (cs);
+    }
+    lock_release (&cs->sector_lock);
+  }
+}
+
+// Marks SECTOR_IDX clean if it is cached, because the journal has just
+// written the same contents home.
+void
+cache_clean (block_sector_t sector_idx)
+{
+  struct cached_sector *cs = lock_if_cached (sector_idx);
+  if (cs != NULL) {
+    mark_clean (cs);
+    lock_release (&cs->sector_lock);
+  }
+}
+
+// Brings SECTOR_IDX into the cache without copying it anywhere, for
+// read-ahead.  Does nothing if the sector is already cached.
+void
+cache_prefetch (block_sector_t sector_idx)
+{
+  struct cache_partition *p = cache_partition_of (sector_idx);
+
+  lock_acquire (&p->lock);
+  bool cached = lookup_cached_sector (p, sector_idx) != NULL;
+  lock_release (&p->lock);
+  if (cached)
+    return;
+
+  struct cached_sector *cs = get_cached_sector (sector_idx, false, PREFETCH_USAGE);
+  lock_release (&cs->sector_lock);
+}
@@ -0,0 +1,49 @@
+#ifndef FILESYS_CACHE_H
+#define FILESYS_CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "devices/block.h"
+
+/* Number of sectors held in the buffer cache unless overridden
+   by the "-cache" kernel command-line option. */
+#define CACHE_DEFAULT_SIZE 64
+
+/* -cache: Number of sectors held in the buffer cache. */
+extern size_t cache_size;
+
+/* -flush-age: Timer ticks a sector may stay dirty before the
+   flusher writes it back. */
+extern int64_t cache_flush_age;
+
+/* -flush-high: Percentage of the cache that may be dirty before
+   the flusher is woken early. */
+extern int cache_flush_high;
+
+struct cached_sector;
+
+void cache_init (void);
+void cache_start_flusher (void);
+void cache_read (block_sector_t, void *);
+void cache_write (block_sector_t, const void *);
+void cache_read_with_size_and_offset (block_sector_t, void *,
+                                      size_t size, size_t sector_ofs);
+void cache_write_with_size_and_offset (block_sector_t, const void *,
+                                       size_t size, size_t sector_ofs,
+                                       block_sector_t inode_sector);
+void cache_write_metadata (block_sector_t, const void *,
+                           size_t size, size_t sector_ofs);
+struct cached_sector *cache_acquire (block_sector_t, bool overwrite);
+const void *cache_read_data (struct cached_sector *);
+void *cache_write_data (struct cached_sector *);
+void cache_release (struct cached_sector *);
+void cache_prefetch (block_sector_t);
+void cache_write_back (block_sector_t);
+void cache_write_back_file (block_sector_t inode_sector);
+void cache_clean (block_sector_t);
+void write_all_dirty_sectors (void);
+void cache_print_stats (void);
+void cache_tick (int64_t now);
+
+#endif /* filesys/cache.h */
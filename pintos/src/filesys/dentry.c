@@ -0,0 +1,203 @@
+#include "filesys/dentry.h"
+#include <debug.h>
+#include <hash.h>
+#include <list.h>
+#include <stdio.h>
+#include <string.h>
+#include "filesys/directory.h"
+#include "threads/synch.h"
+
+/* Number of names the dentry cache holds. */
+#define DENTRY_CNT 512
+
+/* A cached directory entry: what NAME means in the directory
+   whose inode is in sector PARENT.  Negative entries, of type
+   DENTRY_NONE, record that the name is not in use.
+
+   Entries are added by dir_lookup_sector() while it holds the
+   parent directory's dir_lock, and the directory code forgets
+   them under the same lock whenever it adds or removes the name,
+   so an entry never disagrees with the directory. */
+struct dentry
+  {
+    struct hash_elem elem;              /* Element in dentry_index. */
+    struct list_elem lru_elem;          /* Element in dentry_lru or
+                                           dentry_free. */
+    block_sector_t parent;              /* Directory's inode sector. */
+    char name[NAME_MAX + 1];            /* Null terminated name. */
+    enum dentry_type type;              /* What the name refers to. */
+    block_sector_t sector;              /* Its inode sector, unless
+                                           DENTRY_NONE. */
+  };
+
+static struct dentry dentries[DENTRY_CNT];
+static struct lock dentry_lock;         /* Protects everything below. */
+static struct hash dentry_index;        /* Entries in use, by name. */
+static struct list dentry_lru;          /* Entries in use, most recently
+                                           used first. */
+static struct list dentry_free;         /* Entries not in use. */
+static unsigned long long hit_cnt;      /* Lookups answered. */
+static unsigned long long miss_cnt;     /* Lookups not answered. */
+
+static hash_hash_func dentry_hash;
+static hash_less_func dentry_less;
+
+/* Initializes the dentry cache, empty. */
+void
+dentry_init (void)
+{
+  int i;
+
+  lock_init (&dentry_lock);
+  hash_init (&dentry_index, dentry_hash, dentry_less, NULL);
+  list_init (&dentry_lru);
+  list_init (&dentry_free);
+  for (i = 0; i < DENTRY_CNT; i++)
+    list_push_back (&dentry_free, &dentries[i].lru_elem);
+  hit_cnt = miss_cnt = 0;
+}
+
+/* Returns a hash value for the dentry containing E. */
+static unsigned
+dentry_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct dentry *d = hash_entry (e, struct dentry, elem);
+  return hash_string (d->name) ^ hash_int (d->parent);
+}
+
+/* Returns true if dentry A precedes dentry B. */
+static bool
+dentry_less (const struct hash_elem *a, const struct hash_elem *b,
+             void *aux UNUSED)
+{
+  const struct dentry *d_a = hash_entry (a, struct dentry, elem);
+  const struct dentry *d_b = hash_entry (b, struct dentry, elem);
+  if (d_a->parent != d_b->parent)
+    return d_a->parent < d_b->parent;
+  return strcmp (d_a->name, d_b->name) < 0;
+}
+
+/* Returns the entry for NAME in PARENT, or a null pointer.  The
+   caller must hold dentry_lock. */
+static struct dentry *
+find (block_sector_t parent, const char *name)
+{
+  struct dentry key;
+  struct hash_elem *e;
+
+  key.parent = parent;
+  strlcpy (key.name, name, sizeof key.name);
+  e = hash_find (&dentry_index, &key.elem);
+  return e != NULL ? hash_entry (e, struct dentry, elem) : NULL;
+}
+
+/* Removes D from the cache.  The caller must hold dentry_lock. */
+static void
+discard (struct dentry *d)
+{
+  hash_delete (&dentry_index, &d->elem);
+  list_remove (&d->lru_elem);
+  list_push_back (&dentry_free, &d->lru_elem);
+}
+
+/* Looks up NAME in the directory in sector PARENT.  If it is
+   cached, stores what it refers to in *TYPE and, unless that is
+   DENTRY_NONE, its inode sector in *SECTOR, and returns true.
+   Returns false if NAME is not cached. */
+bool
+dentry_lookup (block_sector_t parent, const char *name,
+               enum dentry_type *type, block_sector_t *sector)
+{
+  struct dentry *d;
+
+  if (strlen (name) > NAME_MAX)
+    return false;
+
+  lock_acquire (&dentry_lock);
+  d = find (parent, name);
+  if (d != NULL)
+    {
+      *type = d->type;
+      *sector = d->sector;
+      list_remove (&d->lru_elem);
+      list_push_front (&dentry_lru, &d->lru_elem);
+      hit_cnt++;
+    }
+  else
+    miss_cnt++;
+  lock_release (&dentry_lock);
+  return d != NULL;
+}
+
+/* Records that NAME in the directory in sector PARENT refers to
+   an inode of the given TYPE in SECTOR, evicting the least
+   recently used entry if the cache is full.  The caller must hold
+   the parent directory's dir_lock. */
+void
+dentry_add (block_sector_t parent, const char *name,
+            enum dentry_type type, block_sector_t sector)
+{
+  struct dentry *d;
+
+  /* Longer names are never in a directory, since dir_add()
+     truncates them. */
+  if (strlen (name) > NAME_MAX)
+    return;
+
+  lock_acquire (&dentry_lock);
+  d = find (parent, name);
+  if (d == NULL)
+    {
+      if (list_empty (&dentry_free))
+        discard (list_entry (list_back (&dentry_lru), struct dentry,
+                             lru_elem));
+      d = list_entry (list_pop_front (&dentry_free), struct dentry, lru_elem);
+      d->parent = parent;
+      strlcpy (d->name, name, sizeof d->name);
+      hash_insert (&dentry_index, &d->elem);
+    }
+  else
+    list_remove (&d->lru_elem);
+  d->type = type;
+  d->sector = sector;
+  list_push_front (&dentry_lru, &d->lru_elem);
+  lock_release (&dentry_lock);
+}
+
+/* Forgets what NAME in the directory in sector PARENT refers to.
+   The caller must hold the parent directory's dir_lock. */
+void
+dentry_forget (block_sector_t parent, const char *name)
+{
+  struct dentry *d;
+
+  lock_acquire (&dentry_lock);
+  d = find (parent, name);
+  if (d != NULL)
+    discard (d);
+  lock_release (&dentry_lock);
+}
+
+/* Forgets every name in the directory in sector PARENT, because
+   the directory is gone or its sector now holds a new one. */
+void
+dentry_forget_dir (block_sector_t parent)
+{
+  int i;
+
+  lock_acquire (&dentry_lock);
+  for (i = 0; i < DENTRY_CNT; i++)
+    {
+      struct dentry *d = &dentries[i];
+      if (d->parent == parent && hash_find (&dentry_index, &d->elem) == &d->elem)
+        discard (d);
+    }
+  lock_release (&dentry_lock);
+}
+
+/* Prints dentry cache statistics. */
+void
+dentry_print_stats (void)
+{
+  printf ("Dentry cache: %llu hits, %llu misses\n", hit_cnt, miss_cnt);
+}
@@ -0,0 +1,24 @@
+#ifndef FILESYS_DENTRY_H
+#define FILESYS_DENTRY_H
+
+#include <stdbool.h>
+#include "devices/block.h"
+
+/* What a directory entry names. */
+enum dentry_type
+  {
+    DENTRY_NONE,                /* Nothing: the name is not in use. */
+    DENTRY_FILE,                /* A regular file. */
+    DENTRY_DIR                  /* A directory. */
+  };
+
+void dentry_init (void);
+bool dentry_lookup (block_sector_t parent, const char *name,
+                    enum dentry_type *, block_sector_t *sector);
+void dentry_add (block_sector_t parent, const char *name,
+                 enum dentry_type, block_sector_t sector);
+void dentry_forget (block_sector_t parent, const char *name);
+void dentry_forget_dir (block_sector_t parent);
+void dentry_print_stats (void);
+
+#endif /* filesys/dentry.h */
@@ -1,9 +1,15 @@
 #include "filesys/directory.h"
+#include <dirent.h>
 #include <stdio.h>
+#include <stdint.h>
 #include <string.h>
+#include <hash.h>
 #include <list.h>
+#include "filesys/cache.h"
+#include "filesys/dentry.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "filesys/journal.h"
 #include "threads/thread.h"
 #include "threads/malloc.h"
 
@@ -17,22 +23,214 @@ struct dir_entry
     bool in_use;                        /* In use or free? */
   };
 
-/* Creates a directory with space for ENTRY_CNT entries in the
-   given SECTOR.  Returns true if successful, false on failure. */
+/* Directory layout.  A directory is an extendible hash table of
+   one-sector buckets of entries, so finding, adding or removing a
+   name reads a few sectors however many names the directory has.
+
+   Sector 0 of the directory file holds a struct dir_header.  The
+   next TABLE_SECTORS sectors are the slot table: the low DEPTH
+   bits of a name's hash select one of 1 << DEPTH slots, and that
+   slot holds the number of the bucket the name belongs in.
+   Bucket B is sector FIRST_BUCKET + B of the file.  A bucket whose
+   own depth is LD holds the names whose hashes share its low LD
+   bits, and every slot ending in those bits names it.
+
+   Adding a name to a full bucket splits it: the names whose hash
+   has bit LD set move to a new bucket at the end of the file, and
+   half of the slots naming the old bucket are pointed at the new
+   one, doubling the table first if LD is DEPTH.  Only the two
+   buckets, the header and part of the table change, so a split
+   fits in the transaction of the add that caused it.  The part of
+   the table beyond the current depth is left as a hole.  Buckets
+   are not merged again when names are removed.
+
+   Entries are read back in order of their key, the bit reversal
+   of their name's hash, with ties broken by name.  The names in a
+   bucket of depth LD are those whose keys share their top LD
+   bits, so each bucket covers one range of keys, and a split
+   divides a range in two without moving any name out of it.  A
+   directory's position is the last key and name read, so names
+   neither repeat nor go missing when buckets split between
+   reads. */
+#define DIR_MAGIC 0x48524944            /* "DIRH". */
+#define MAX_DEPTH 12                    /* Deepest slot table. */
+#define TABLE_SECTORS (((size_t) 1 << MAX_DEPTH) * sizeof (uint16_t) \
+                       / BLOCK_SECTOR_SIZE)
+#define TABLE_OFS BLOCK_SECTOR_SIZE
+#define FIRST_BUCKET (1 + TABLE_SECTORS)
+#define BUCKET_ENTRIES 25
+
+/* First sector of a directory. */
+struct dir_header
+  {
+    uint32_t magic;                     /* DIR_MAGIC. */
+    uint32_t depth;                     /* Bits of hash used by the table. */
+    uint32_t bucket_cnt;                /* Buckets in the file. */
+    uint32_t entry_cnt;                 /* Entries in use. */
+  };
+
+/* One sector of directory entries. */
+struct dir_bucket
+  {
+    uint32_t depth;                     /* Bits of hash its names share. */
+    uint32_t unused[2];
+    struct dir_entry entries[BUCKET_ENTRIES];
+  };
+
+/* Most journaled sectors removing one entry can change: its
+   bucket and the header. */
+#define DIR_REMOVE_CREDITS 2
+
+static off_t
+bucket_ofs (size_t b)
+{
+  return (FIRST_BUCKET + b) * BLOCK_SECTOR_SIZE;
+}
+
+/* Returns the offset of entry I of bucket B. */
+static off_t
+entry_ofs (size_t b, size_t i)
+{
+  return (bucket_ofs (b) + offsetof (struct dir_bucket, entries)
+          + i * sizeof (struct dir_entry));
+}
+
+/* Copies SIZE bytes at offset OFS of directory INODE into BUF.
+   The bytes must lie within one sector, which is read in place
+   in the buffer cache.  Returns false if it cannot be read. */
+static bool
+read_dir (struct inode *inode, void *buf, size_t size, off_t ofs)
+{
+  struct cached_sector *cs = inode_acquire_sector (inode, ofs);
+
+  ASSERT (ofs % BLOCK_SECTOR_SIZE + size <= BLOCK_SECTOR_SIZE);
+
+  if (cs == NULL)
+    return false;
+  memcpy (buf, (const uint8_t *) cache_read_data (cs) + ofs % BLOCK_SECTOR_SIZE,
+          size);
+  cache_release (cs);
+  return true;
+}
+
+static bool
+read_header (struct inode *inode, struct dir_header *h)
+{
+  return read_dir (inode, h, sizeof *h, 0) && h->magic == DIR_MAGIC;
+}
+
+static bool
+write_header (struct inode *inode, const struct dir_header *h)
+{
+  return inode_write_at (inode, h, sizeof *h, 0) == sizeof *h;
+}
+
+static bool
+read_bucket (struct inode *inode, size_t b, struct dir_bucket *bucket)
+{
+  return read_dir (inode, bucket, sizeof *bucket, bucket_ofs (b));
+}
+
+static bool
+write_bucket (struct inode *inode, size_t b, const struct dir_bucket *bucket)
+{
+  return (inode_write_at (inode, bucket, sizeof *bucket, bucket_ofs (b))
+          == sizeof *bucket);
+}
+
+/* Returns the slot of a directory with header H that NAME hashes
+   to. */
+static size_t
+name_slot (const struct dir_header *h, const char *name)
+{
+  return hash_string (name) & (((size_t) 1 << h->depth) - 1);
+}
+
+/* Stores in *BP the number of the bucket of directory INODE,
+   whose header is H, that SLOT names.  Returns false if it cannot
+   be read. */
+static bool
+slot_bucket (struct inode *inode, const struct dir_header *h, size_t slot,
+             size_t *bp)
+{
+  uint16_t b;
+
+  if (!read_dir (inode, &b, sizeof b, TABLE_OFS + slot * sizeof b)
+      || b >= h->bucket_cnt)
+    return false;
+  *bp = b;
+  return true;
+}
+
+/* Scans bucket B of directory INODE in place for an entry not in
+   use and stores its index in *IP, or BUCKET_ENTRIES if the bucket
+   is full.  Returns false if the bucket cannot be read. */
+static bool
+find_free (struct inode *inode, size_t b, size_t *ip)
+{
+  struct cached_sector *cs = inode_acquire_sector (inode, bucket_ofs (b));
+  const struct dir_bucket *bucket;
+  size_t i;
+
+  if (cs == NULL)
+    return false;
+  bucket = cache_read_data (cs);
+  for (i = 0; i < BUCKET_ENTRIES; i++)
+    if (!bucket->entries[i].in_use)
+      break;
+  cache_release (cs);
+  *ip = i;
+  return true;
+}
+
+/* Returns the most journaled sectors adding one entry to a
+   directory can change: the header, the slot table, every bucket
+   a chain of splits can write, and the growth of the file. */
+size_t
+dir_add_credits (void)
+{
+  return (1 + TABLE_SECTORS + (MAX_DEPTH + 1)
+          + inode_credits ((TABLE_SECTORS + MAX_DEPTH) * BLOCK_SECTOR_SIZE));
+}
+
+/* Creates a directory in the given SECTOR, with entries for
+   itself and PARENT_SECTOR.  Directories grow as names are added,
+   so ENTRY_CNT is only a hint and is not used.  Returns true if
+   successful, false on failure. */
 bool
- dir_create (block_sector_t sector, size_t entry_cnt, block_sector_t parent_sector)
+ dir_create (block_sector_t sector, size_t entry_cnt UNUSED, block_sector_t parent_sector)
 {
-  if (inode_create_dir (sector, (entry_cnt + 2) * sizeof (struct dir_entry))) {
-    struct dir *dir = dir_open(inode_open(sector));
-    bool success = dir_add(dir, PARENT_NAME, parent_sector) && dir_add(dir, SELF_NAME, sector);
-    dir_close(dir);
-    return success;
-  }
-  return false;
+  struct dir_header h;
+  struct dir_bucket *bucket;
+  uint16_t slot = 0;
+  bool success;
+
+  ASSERT (sizeof *bucket == BLOCK_SECTOR_SIZE);
+
+  if (!inode_create_dir (sector, 0))
+    return false;
+  dentry_forget_dir (sector);
+  struct dir *dir = dir_open(inode_open(sector));
+  bucket = calloc (1, sizeof *bucket);
+  h.magic = DIR_MAGIC;
+  h.depth = 0;
+  h.bucket_cnt = 1;
+  h.entry_cnt = 0;
+  success = (dir != NULL && bucket != NULL
+             && write_bucket (dir->inode, 0, bucket)
+             && inode_write_at (dir->inode, &slot, sizeof slot, TABLE_OFS)
+                == sizeof slot
+             && write_header (dir->inode, &h)
+             && dir_add(dir, PARENT_NAME, parent_sector)
+             && dir_add(dir, SELF_NAME, sector));
+  free (bucket);
+  dir_close(dir);
+  return success;
 }
 
 /* Opens and returns the directory for the given INODE, of which
-   it takes ownership.  Returns a null pointer on failure. */
+   it takes ownership, positioned before its first entry.  Returns
+   a null pointer on failure. */
 struct dir *
 dir_open (struct inode *inode)
 {
@@ -40,7 +238,6 @@ dir_open (struct inode *inode)
   if (inode != NULL && dir != NULL)
     {
       dir->inode = inode;
-      dir->pos = 0;
       return dir;
     }
   else
@@ -85,32 +282,95 @@ dir_get_inode (struct dir *dir)
   return dir->inode;
 }
 
-/* Searches DIR for a file with the given NAME.
+/* Searches DIR, whose header is H, for a file with the given NAME.
    If successful, returns true, sets *EP to the directory entry
    if EP is non-null, and sets *OFSP to the byte offset of the
    directory entry if OFSP is non-null.
-   otherwise, returns false and ignores EP and OFSP. */
+   otherwise, returns false and ignores EP and OFSP.
+   The caller must hold DIR's dir_lock. */
 static bool
-lookup (const struct dir *dir, const char *name,
+lookup (const struct dir *dir, const struct dir_header *h, const char *name,
         struct dir_entry *ep, off_t *ofsp)
 {
-  struct dir_entry e;
-  size_t ofs;
+  const struct dir_bucket *bucket;
+  struct cached_sector *cs;
+  bool found = false;
+  size_t b, i;
 
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
-  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-       ofs += sizeof e)
-    if (e.in_use && !strcmp (name, e.name))
-      {
-        if (ep != NULL)
-          *ep = e;
-        if (ofsp != NULL)
-          *ofsp = ofs;
-        return true;
-      }
-  return false;
+  /* Scan NAME's bucket in place in the buffer cache. */
+  if (!slot_bucket (dir->inode, h, name_slot (h, name), &b))
+    return false;
+  cs = inode_acquire_sector (dir->inode, bucket_ofs (b));
+  if (cs == NULL)
+    return false;
+  bucket = cache_read_data (cs);
+  for (i = 0; i < BUCKET_ENTRIES; i++)
+    {
+      const struct dir_entry *e = &bucket->entries[i];
+      if (e->in_use && !strcmp (name, e->name))
+        {
+          if (ep != NULL)
+            *ep = *e;
+          if (ofsp != NULL)
+            *ofsp = entry_ofs (b, i);
+          found = true;
+          break;
+        }
+    }
+  cache_release (cs);
+  return found;
+}
+
+/* Searches the directory whose inode is in sector DIR_SECTOR for
+   a file with the given NAME, through the dentry cache, and
+   returns true if one exists, false otherwise.  On success, sets
+   *SECTORP to the file's inode sector and *ISDIRP to whether it
+   is a directory.  A name found in the cache needs no disk
+   access. */
+bool
+dir_lookup_sector (block_sector_t dir_sector, const char *name,
+                   block_sector_t *sectorp, bool *isdirp)
+{
+  enum dentry_type type = DENTRY_NONE;
+  struct dir_header h;
+  struct dir_entry e;
+  struct inode *child = NULL;
+  struct dir *dir;
+
+  ASSERT (name != NULL);
+
+  if (dentry_lookup (dir_sector, name, &type, sectorp))
+    {
+      *isdirp = type == DENTRY_DIR;
+      return type != DENTRY_NONE;
+    }
+
+  dir = dir_open (inode_open (dir_sector));
+  if (dir == NULL)
+    return false;
+  lock_acquire (&dir->inode->dir_lock);
+  if (read_header (dir->inode, &h))
+    {
+      if (!lookup (dir, &h, name, &e, NULL))
+        dentry_add (dir_sector, name, DENTRY_NONE, 0);
+      else if ((child = inode_open (e.inode_sector)) != NULL)
+        {
+          type = is_dir (child) ? DENTRY_DIR : DENTRY_FILE;
+          dentry_add (dir_sector, name, type, e.inode_sector);
+          *sectorp = e.inode_sector;
+          *isdirp = type == DENTRY_DIR;
+        }
+    }
+  lock_release (&dir->inode->dir_lock);
+
+  /* Closing may free a removed inode, which opens a journal handle,
+     so not while holding dir_lock. */
+  inode_close (child);
+  dir_close (dir);
+  return type != DENTRY_NONE;
 }
 
 /* Searches DIR for a file with the given NAME
@@ -121,64 +381,153 @@ bool
 dir_lookup (const struct dir *dir, const char *name,
             struct inode **inode)
 {
-  struct dir_entry e;
+  block_sector_t sector;
+  bool isdir;
 
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
-  if (lookup (dir, name, &e, NULL)) {
-    *inode = inode_open (e.inode_sector);
+  if (dir_lookup_sector (dir->inode->sector, name, &sector, &isdir)) {
+    *inode = inode_open (sector);
   } else {
     *inode = NULL;
   }
   return *inode != NULL;
 }
 
+/* Splits bucket B of directory INODE, whose header is H and which
+   has been read into BUCKET, and updates *H to match.  SLOT is a
+   slot that names the bucket.  Returns false if the bucket is
+   already as deep as it can be or a disk or memory error
+   occurs. */
+static bool
+split_bucket (struct inode *inode, struct dir_header *h, size_t slot,
+              size_t b, struct dir_bucket *bucket)
+{
+  uint32_t depth = bucket->depth;
+  size_t slot_cnt = (size_t) 1 << h->depth;
+  size_t new_b = h->bucket_cnt;
+  struct dir_bucket *split = NULL;
+  uint16_t *slots = NULL;
+  size_t first, start, s, i, j;
+  bool success = false;
+
+  if (depth == MAX_DEPTH || new_b > UINT16_MAX)
+    return false;
+
+  /* Read the slot table, doubling it if the bucket is as deep as
+     the table. */
+  slots = malloc (2 * slot_cnt * sizeof *slots);
+  split = calloc (1, sizeof *split);
+  if (slots == NULL || split == NULL
+      || (inode_read_at (inode, slots, slot_cnt * sizeof *slots, TABLE_OFS)
+          != (off_t) (slot_cnt * sizeof *slots)))
+    goto done;
+  start = slot_cnt;
+  if (depth == h->depth)
+    {
+      memcpy (slots + slot_cnt, slots, slot_cnt * sizeof *slots);
+      slot_cnt *= 2;
+    }
+
+  /* Move the names with bit DEPTH of their hash set. */
+  bucket->depth = split->depth = depth + 1;
+  for (i = j = 0; i < BUCKET_ENTRIES; i++)
+    {
+      struct dir_entry *e = &bucket->entries[i];
+      if (e->in_use && (hash_string (e->name) >> depth) & 1)
+        {
+          split->entries[j++] = *e;
+          e->in_use = false;
+        }
+    }
+
+  /* Point the slots for those names at the new bucket, and write
+     back the table from the first slot that changed or is new. */
+  first = (slot & (((size_t) 1 << depth) - 1)) | ((size_t) 1 << depth);
+  for (s = first; s < slot_cnt; s += (size_t) 2 << depth)
+    slots[s] = new_b;
+  if (start == slot_cnt)
+    start = first;
+  if (!write_bucket (inode, new_b, split)
+      || !write_bucket (inode, b, bucket)
+      || (inode_write_at (inode, slots + start,
+                          (slot_cnt - start) * sizeof *slots,
+                          TABLE_OFS + start * sizeof *slots)
+          != (off_t) ((slot_cnt - start) * sizeof *slots)))
+    goto done;
+
+  if (slot_cnt > ((size_t) 1 << h->depth))
+    h->depth++;
+  h->bucket_cnt++;
+  success = write_header (inode, h);
+
+ done:
+  free (slots);
+  free (split);
+  return success;
+}
+
 /* Adds a file named NAME to DIR, which must not already contain a
    file by that name.  The file's inode is in sector
    INODE_SECTOR.
    Returns true if successful, false on failure.
-   Fails if NAME is invalid (i.e. too long) or a disk or memory
-   error occurs. */
+   Fails if NAME is invalid (i.e. too long), the directory cannot
+   grow, or a disk or memory error occurs. */
 bool
 dir_add (struct dir *dir, const char *name, block_sector_t sector)
 {
-  struct dir_entry e;
-  off_t ofs;
+  struct dir_header h;
   bool success = false;
 
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
-  char newname[NAME_MAX + 1];
-  memset(newname, 0, NAME_MAX + 1);
-  struct inode *inode;
-
+  journal_begin (dir_add_credits ());
+  lock_acquire (&dir->inode->dir_lock);
 
   /* Check that NAME is not in use. */
-  if (lookup (dir, name, NULL, NULL))
+  if (!read_header (dir->inode, &h) || lookup (dir, &h, name, NULL, NULL))
     goto done;
 
-  /* Set OFS to offset of free slot.
-     If there are no free slots, then it will be set to the
-     current end-of-file.
-
-     inode_read_at() will only return a short read at end of file.
-     Otherwise, we'd need to verify that we didn't get a short
-     read due to something intermittent such as low memory. */
-  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-       ofs += sizeof e)
-    if (!e.in_use)
-      break;
+  /* Find a free entry in NAME's bucket, splitting the bucket until
+     there is one. */
+  for (;;)
+    {
+      size_t slot = name_slot (&h, name);
+      size_t b, i;
 
-  /* Write slot. */
-  e.in_use = true;
-  strlcpy (e.name, name, sizeof e.name);
-  e.inode_sector = sector;
+      if (!slot_bucket (dir->inode, &h, slot, &b)
+          || !find_free (dir->inode, b, &i))
+        goto done;
+      if (i == BUCKET_ENTRIES)
+        {
+          struct dir_bucket *bucket = malloc (sizeof *bucket);
+          bool split = (bucket != NULL
+                        && read_bucket (dir->inode, b, bucket)
+                        && split_bucket (dir->inode, &h, slot, b, bucket));
+          free (bucket);
+          if (!split)
+            goto done;
+          continue;
+        }
 
-  success = inode_write_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
+      /* Write slot. */
+      struct dir_entry e;
+      e.in_use = true;
+      strlcpy (e.name, name, sizeof e.name);
+      e.inode_sector = sector;
+      h.entry_cnt++;
+      success = (inode_write_at (dir->inode, &e, sizeof e, entry_ofs (b, i))
+                 == sizeof e
+                 && write_header (dir->inode, &h));
+      dentry_forget (dir->inode->sector, name);
+      break;
+    }
 
  done:
+  lock_release (&dir->inode->dir_lock);
+  journal_end ();
   return success;
 }
 
@@ -198,17 +547,10 @@ bool chdir(char *name) {
   return false;
 }
 
+/* Returns the number of entries in DIR, counting "." and "..". */
 int number_entries(struct dir *dir) {
-  size_t ofs;
-  struct dir_entry e;
-  int count = 0;
-  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-      ofs += sizeof e) {
-        if (e.in_use) {
-          count++;
-        }
-  }
-  return count;
+  struct dir_header h;
+  return read_header (dir->inode, &h) ? (int) h.entry_cnt : 0;
 }
 
 /* Removes any entry for NAME in DIR.
@@ -217,6 +559,7 @@ int number_entries(struct dir *dir) {
 bool
 dir_remove (struct dir *dir, const char *name)
 {
+  struct dir_header h;
   struct dir_entry e;
   struct inode *inode = NULL;
   bool success = false;
@@ -225,8 +568,11 @@ dir_remove (struct dir *dir, const char *name)
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
+  journal_begin (DIR_REMOVE_CREDITS);
+  lock_acquire (&dir->inode->dir_lock);
+
   /* Find directory entry. */
-  if (!lookup (dir, name, &e, &ofs)) {
+  if (!read_header (dir->inode, &h) || !lookup (dir, &h, name, &e, &ofs)) {
     // printf("cant find dir in remove\n");
     goto done;
   }
@@ -264,50 +610,255 @@ dir_remove (struct dir *dir, const char *name)
     // printf("cant write to inode in remove\n");
     goto done;
   }
+  dentry_forget (dir->inode->sector, name);
+  if (is_dir (inode))
+    dentry_forget_dir (inode->sector);
+  h.entry_cnt--;
+  if (!write_header (dir->inode, &h))
+    goto done;
 
   /* Remove inode. */
   inode_remove (inode);
   success = true;
 
  done:
+  lock_release (&dir->inode->dir_lock);
+  journal_end ();
   inode_close (inode);
   return success;
 }
 
-/* Reads the next directory entry in DIR and stores the name in
-   NAME.  Returns true if successful, false if the directory
-   contains no more entries. */
-bool
-dir_readdir (struct dir *dir, char name[NAME_MAX + 1])
+/* Returns the bits of X in reverse order. */
+static uint32_t
+reverse_bits (uint32_t x)
 {
-  struct dir_entry e;
+  uint32_t r = 0;
+  int i;
+
+  for (i = 0; i < 32; i++)
+    {
+      r = (r << 1) | (x & 1);
+      x >>= 1;
+    }
+  return r;
+}
+
+/* Returns the key that orders NAME in directory reads. */
+static uint32_t
+name_key (const char *name)
+{
+  return reverse_bits (hash_string (name));
+}
+
+/* Stores in *BP the number of the bucket of DIR, whose header is
+   H, whose range of keys holds DIR's position.  Returns false if
+   it cannot be read. */
+static bool
+pos_bucket (const struct dir *dir, const struct dir_header *h, size_t *bp)
+{
+  size_t slot = reverse_bits (dir->pos_key) & (((size_t) 1 << h->depth) - 1);
+  return slot_bucket (dir->inode, h, slot, bp);
+}
+
+/* Returns true if entry E comes after DIR's position. */
+static bool
+after_pos (const struct dir *dir, const struct dir_entry *e)
+{
+  uint32_t key = name_key (e->name);
+  if (key != dir->pos_key)
+    return key > dir->pos_key;
+  return strcmp (e->name, dir->pos_name) > 0;
+}
 
-  while (inode_read_at (dir->inode, &e, sizeof e, dir->pos) == sizeof e)
+/* Returns the index of the entry in BUCKET that comes first after
+   DIR's position, or BUCKET_ENTRIES if none does. */
+static size_t
+next_entry (const struct dir *dir, const struct dir_bucket *bucket)
+{
+  size_t next = BUCKET_ENTRIES;
+  uint32_t next_key = 0;
+  size_t i;
+
+  for (i = 0; i < BUCKET_ENTRIES; i++)
     {
-      dir->pos += sizeof e;
-      if (e.in_use && strcmp(e.name, SELF_NAME) != 0 && strcmp(e.name, PARENT_NAME) != 0)
+      const struct dir_entry *e = &bucket->entries[i];
+      uint32_t key;
+
+      if (!e->in_use || !after_pos (dir, e))
+        continue;
+      key = name_key (e->name);
+      if (next == BUCKET_ENTRIES || key < next_key
+          || (key == next_key
+              && strcmp (e->name, bucket->entries[next].name) < 0))
         {
-          strlcpy (name, e.name, NAME_MAX + 1);
-          return true;
+          next = i;
+          next_key = key;
         }
     }
-  return false;
+  return next;
+}
+
+/* Moves DIR's position to entry E. */
+static void
+set_pos (struct dir *dir, const struct dir_entry *e)
+{
+  dir->pos_key = name_key (e->name);
+  strlcpy (dir->pos_name, e->name, sizeof dir->pos_name);
+}
+
+/* Moves DIR's position past the range of keys of the bucket that
+   holds it, whose depth is DEPTH, to the start of the next range.
+   Sets pos_end if there is none. */
+static void
+next_range (struct dir *dir, uint32_t depth)
+{
+  uint32_t span;
+
+  if (depth == 0)
+    {
+      dir->pos_end = true;
+      return;
+    }
+  span = (uint32_t) 1 << (32 - depth);
+  dir->pos_key = (dir->pos_key & ~(span - 1)) + span;
+  dir->pos_name[0] = '\0';
+  if (dir->pos_key == 0)
+    dir->pos_end = true;
+}
+
+/* Returns true if E is the entry for "." or "..". */
+static bool
+is_dot_entry (const struct dir_entry *e)
+{
+  return !strcmp (e->name, SELF_NAME) || !strcmp (e->name, PARENT_NAME);
+}
+
+/* Reads the next directory entry in DIR and stores the name in
+   NAME.  Returns true if successful, false if the directory
+   contains no more entries.  Each bucket is scanned in place in
+   the buffer cache. */
+bool
+dir_readdir (struct dir *dir, char name[NAME_MAX + 1])
+{
+  char found_name[NAME_MAX + 1];
+  struct dir_header h;
+  bool found = false;
+
+  lock_acquire (&dir->inode->dir_lock);
+  if (read_header (dir->inode, &h))
+    while (!found && !dir->pos_end)
+      {
+        struct cached_sector *cs;
+        const struct dir_bucket *bucket;
+        size_t b, i;
+
+        if (!pos_bucket (dir, &h, &b))
+          break;
+        cs = inode_acquire_sector (dir->inode, bucket_ofs (b));
+        if (cs == NULL)
+          break;
+        bucket = cache_read_data (cs);
+        while (!found && (i = next_entry (dir, bucket)) < BUCKET_ENTRIES)
+          {
+            const struct dir_entry *e = &bucket->entries[i];
+            set_pos (dir, e);
+            if (!is_dot_entry (e))
+              {
+                strlcpy (found_name, e->name, sizeof found_name);
+                found = true;
+              }
+          }
+        if (!found)
+          next_range (dir, bucket->depth);
+        cache_release (cs);
+      }
+  lock_release (&dir->inode->dir_lock);
+
+  /* NAME is in user memory, so not copied while the sector is
+     pinned. */
+  if (found)
+    strlcpy (name, found_name, NAME_MAX + 1);
+  return found;
+}
+
+/* Reads entries of DIR from its position onward into ENTRIES,
+   up to CNT of them, skipping "." and "..".  Copies a whole bucket
+   of entries at a time, so that no sector is pinned while inodes
+   are opened, and finds each entry's type in the dentry
+   cache when it is there.  Returns the number of entries stored,
+   which is 0 at the end of the directory. */
+size_t
+dir_readdir_batch (struct dir *dir, struct dirent *entries, size_t cnt)
+{
+  struct dir_bucket *bucket;
+  struct dir_header h;
+  size_t n = 0;
+  size_t b, i;
+
+  ASSERT (DIRENT_NAME_MAX == NAME_MAX);
+
+  bucket = malloc (sizeof *bucket);
+  if (bucket == NULL)
+    return 0;
+
+  lock_acquire (&dir->inode->dir_lock);
+  if (read_header (dir->inode, &h))
+    while (n < cnt && !dir->pos_end && pos_bucket (dir, &h, &b)
+           && read_bucket (dir->inode, b, bucket))
+      {
+        while (n < cnt && (i = next_entry (dir, bucket)) < BUCKET_ENTRIES)
+          {
+            struct dir_entry *e = &bucket->entries[i];
+            enum dentry_type type;
+            block_sector_t sector;
+
+            set_pos (dir, e);
+            if (is_dot_entry (e))
+              continue;
+
+            /* An inode named by an entry has not been removed, so
+               closing it here cannot free it. */
+            if (!dentry_lookup (dir->inode->sector, e->name, &type, &sector))
+              {
+                struct inode *child = inode_open (e->inode_sector);
+                if (child == NULL)
+                  continue;
+                type = is_dir (child) ? DENTRY_DIR : DENTRY_FILE;
+                dentry_add (dir->inode->sector, e->name, type, e->inode_sector);
+                inode_close (child);
+              }
+            entries[n].inumber = e->inode_sector;
+            entries[n].isdir = type == DENTRY_DIR;
+            strlcpy (entries[n].name, e->name, sizeof entries[n].name);
+            n++;
+          }
+        if (n < cnt)
+          next_range (dir, bucket->depth);
+      }
+  lock_release (&dir->inode->dir_lock);
+
+  free (bucket);
+  return n;
 }
 
+/* Points the ".." entry of DIR at PARENT_SECTOR. */
 bool
 change_parent_dir(struct dir *dir, block_sector_t parent_sector) {
+  struct dir_header h;
   struct dir_entry e;
   off_t ofs;
   bool success = false;
 
-  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-       ofs += sizeof e)
-    if (strcmp(e.name, PARENT_NAME))
-      break;
-
-  e.inode_sector = parent_sector;
-
-  success = inode_write_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
+  journal_begin (DIR_REMOVE_CREDITS);
+  lock_acquire (&dir->inode->dir_lock);
+  if (read_header (dir->inode, &h) && lookup (dir, &h, PARENT_NAME, &e, &ofs))
+    {
+      e.inode_sector = parent_sector;
+      success = inode_write_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
+      dentry_forget (dir->inode->sector, PARENT_NAME);
+    }
+  lock_release (&dir->inode->dir_lock);
+  journal_end ();
 
   return success;
 }
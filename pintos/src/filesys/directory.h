@@ -3,6 +3,7 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 #include "devices/block.h"
 #include "filesys/filesys.h"
 
@@ -18,10 +19,14 @@
 struct dir
   {
     struct inode *inode;                /* Backing store. */
-    off_t pos;                          /* Current position. */
+    uint32_t pos_key;                   /* Position: the key and name of */
+    char pos_name[NAME_MAX + 1];        /* the last entry read, or 0 and
+                                           "" before the first. */
+    bool pos_end;                       /* True once all entries are read. */
   };
 
 struct inode;
+struct dirent;
 
 /* Opening and closing directories. */
 bool dir_create (block_sector_t sector, size_t entry_cnt, block_sector_t parent);
@@ -33,9 +38,13 @@ struct inode *dir_get_inode (struct dir *);
 
 /* Reading and writing. */
 bool dir_lookup (const struct dir *, const char *name, struct inode **);
+bool dir_lookup_sector (block_sector_t, const char *name,
+                        block_sector_t *, bool *isdir);
 bool dir_add (struct dir *, const char *name, block_sector_t);
 bool dir_remove (struct dir *, const char *name);
+size_t dir_add_credits (void);
 bool dir_readdir (struct dir *, char name[NAME_MAX + 1]);
+size_t dir_readdir_batch (struct dir *, struct dirent *, size_t cnt);
 int dir_inumber(struct dir *dir);
 bool chdir(char *name);
 bool set_dir(char * dirname, struct dir *dir);
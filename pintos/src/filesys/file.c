@@ -142,6 +142,14 @@ file_length (struct file *file)
   return inode_length (file->inode);
 }
 
+/* Writes FILE's data and metadata to disk. */
+void
+file_sync (struct file *file)
+{
+  ASSERT (file != NULL);
+  inode_sync (file->inode);
+}
+
 /* Sets the current position in FILE to NEW_POS bytes from the
    start of the file. */
 void
@@ -2,9 +2,12 @@
 #include <debug.h>
 #include <stdio.h>
 #include <string.h>
+#include "filesys/cache.h"
+#include "filesys/dentry.h"
 #include "filesys/file.h"
 #include "filesys/free-map.h"
 #include "filesys/inode.h"
+#include "filesys/journal.h"
 #include "filesys/directory.h"
 #include "threads/thread.h"
 #include "userprog/syscall.h"
@@ -14,6 +17,8 @@
 struct block *fs_device;
 
 static void do_format (void);
+static bool walk_path (const char *fp, block_sector_t *sectorp,
+                       char last[NAME_MAX + 1]);
 
 /* Initializes the file system module.
    If FORMAT is true, reformats the file system. */
@@ -25,12 +30,15 @@ filesys_init (bool format)
     PANIC ("No file system device found, can't initialize file system.");
 
   inode_init (); 
+  dentry_init ();
   free_map_init ();
+  journal_init (format);
 
   if (format)
     do_format ();
 
   free_map_open ();
+  cache_start_flusher ();
 }
 
 /* Shuts down the file system module, writing any unwritten data
@@ -38,14 +46,26 @@ filesys_init (bool format)
 void
 filesys_done (void)
 {
-  write_all_dirty_sectors ();
+  journal_commit ();
   free_map_close ();
+  journal_done ();
+  write_all_dirty_sectors ();
 }
 
+/* Writes every file's data and metadata to disk. */
+void
+filesys_sync (void)
+{
+  write_all_dirty_sectors ();
+  journal_commit ();
+}
+
 /* Creates a file named NAME with the given INITIAL_SIZE.
    Returns true if successful, false otherwise.
    Fails if a file named NAME already exists,
-   or if internal memory allocation fails. */
+   or if internal memory allocation fails.
+   The new inode and its directory entry are one journal
+   transaction. */
 bool
 filesys_create (const char *name, off_t initial_size, bool isdir)
 {
@@ -58,14 +78,16 @@ filesys_create (const char *name, off_t initial_size, bool isdir)
     return false;
   }
 
+  journal_begin (1 + inode_credits (initial_size)
+                 + (isdir ? 3 : 1) * dir_add_credits ());
   if (isdir) { 
     success = (dir != NULL
-            && free_map_allocate (1, &inode_sector)
+            && free_map_allocate_run (dir->inode->sector, 1, &inode_sector) == 1
             && dir_create (inode_sector, initial_size, dir->inode->sector)
             && dir_add(dir, filename, inode_sector));
   } else {
   success = (dir != NULL
-            && free_map_allocate (1, &inode_sector)
+            && free_map_allocate_run (dir->inode->sector, 1, &inode_sector) == 1
             && inode_create (inode_sector, initial_size)
             && dir_add (dir, filename, inode_sector));
   }
@@ -73,6 +95,7 @@ filesys_create (const char *name, off_t initial_size, bool isdir)
     free_map_release (inode_sector, 1);
   }
   dir_close (dir);
+  journal_end ();
 
   return success;
 }
@@ -85,8 +108,8 @@ filesys_create (const char *name, off_t initial_size, bool isdir)
 void *
 filesys_open (const char *name, bool *isdir)
 {
-  struct dir *dir;
   struct inode *inode;
+  block_sector_t sector;
 
   char *root = "/";
   if (strcmp(name, root) == 0) {
@@ -94,36 +117,61 @@ filesys_open (const char *name, bool *isdir)
     return dir_open_root();
   }
 
-  dir = get_last_dir(name);
-
-  if (dir == NULL) {
+  char filename[NAME_MAX + 1];
+  if (strcmp(name, "") == 0 || !walk_path(name, &sector, filename)
+      || filename[0] == '\0'
+      || !dir_lookup_sector(sector, filename, &sector, isdir)) {
     return NULL;
   }
 
-  char filename[NAME_MAX + 1];
-  get_filename_from_path(name, filename);
-
-  bool success = dir_lookup(dir, filename, &inode);
-
-  if (!success) {
+  inode = inode_open(sector);
+  if (inode == NULL) {
     return NULL;
   }
 
-  dir_close (dir);
-
-  if (is_dir(inode)) {
-    *isdir = true;
+  if (*isdir) {
     return dir_open(inode);
   } else {
-    *isdir = false;
     return file_open(inode);
   }
 }
 
+/* Stores information about the file named NAME in *ST.  Returns
+   true if successful, false if no file named NAME exists.  Only
+   the file's own inode is opened, not the file or any directory
+   on its path. */
+bool
+filesys_stat (const char *name, struct stat *st)
+{
+  struct inode *inode;
+  block_sector_t sector;
+  char filename[NAME_MAX + 1];
+  bool isdir;
+
+  if (strcmp(name, "/") == 0) {
+    sector = ROOT_DIR_SECTOR;
+  } else if (strcmp(name, "") == 0 || !walk_path(name, &sector, filename)
+             || filename[0] == '\0'
+             || !dir_lookup_sector(sector, filename, &sector, &isdir)) {
+    return false;
+  }
+
+  inode = inode_open(sector);
+  if (inode == NULL) {
+    return false;
+  }
+  inode_stat(inode, st);
+  inode_close(inode);
+  return true;
+}
+
 /* Deletes the file named NAME.
    Returns true if successful, false on failure.
    Fails if no file named NAME exists,
-   or if an internal memory allocation fails. */
+   or if an internal memory allocation fails.
+   Removing the directory entry and freeing the file's sectors
+   are separate journal transactions, since the file may stay
+   open long after it is removed. */
 bool
 filesys_remove (const char *name)
 {
@@ -175,63 +223,58 @@ get_next_part (char part[NAME_MAX + 1], const char **srcp) {
   return 1;
 }
 
-// Returns the last dir in the fp, or null if there is a problem
-struct dir 
-*get_last_dir(const char *fp) {
-  if (strcmp(fp, "") == 0) {
-    return NULL;
-  }
-
-  struct dir *dir = NULL;
-  struct dir *prev = NULL;
+/* Follows path FP, from the root directory if it is absolute or
+   the current directory otherwise, through every component but
+   the last, which must all be directories.  Stores the inode
+   sector of the directory reached in *SECTORP and the last
+   component in LAST, which is empty if FP has no components.
+   Returns false if a component is missing, is not a directory or
+   is too long.  Uses only the dentry cache for recently used
+   paths, without opening any directory. */
+static bool
+walk_path (const char *fp, block_sector_t *sectorp, char last[NAME_MAX + 1])
+{
+  block_sector_t sector;
+  char next[NAME_MAX + 1];
+  int status;
 
-  if (fp[0] == '/') { // use absolute 
-    dir = dir_open_root();
-  } else { // use cwd
+  if (fp[0] == '/') {
+    sector = ROOT_DIR_SECTOR;
+  } else {
     struct thread *t = thread_current();
     if (t->cwd == NULL) {
       t->cwd = dir_open_root();
-    } 
-    dir = dir_reopen(t->cwd);
+    }
+    sector = dir_inumber(t->cwd);
   }
 
-  char name[NAME_MAX + 1];
-  memset(name, 0, NAME_MAX + 1);
-  struct inode *inode;
-  while (get_next_part(name, &fp)) {
-    bool success = dir_lookup(dir, name, &inode);
-    if (!success) {  
-
-      if (get_next_part(name, &fp) != 1) { // we've gone to the last dir
-        if (prev != NULL) {
-          dir_close(prev);
-        }
-        return dir;
-      }
-      
-      dir_close(dir);
-      return NULL; // we can still go deeper into fp, missing a directory somewhere
-    } 
-    
-    if (!is_dir(inode)) {
-      if (get_next_part(name, &fp) == 0) { // gotten the last file, return dir
-        if (prev != NULL) {
-          dir_close(prev);
-        }
-        return dir;
-      }
-      dir_close(dir);
-      printf("not dir and not end\n");
-      return NULL;
-    }
-    if (prev != NULL) {
-      dir_close(prev);
+  last[0] = '\0';
+  status = get_next_part(last, &fp);
+  while (status == 1 && (status = get_next_part(next, &fp)) == 1) {
+    block_sector_t child;
+    bool isdir;
+
+    if (!dir_lookup_sector(sector, last, &child, &isdir) || !isdir) {
+      return false;
     }
-    prev = dir;
-    dir = dir_open(inode);
+    sector = child;
+    strlcpy(last, next, NAME_MAX + 1);
   }
-  dir_close(dir);
-  return prev;
+  *sectorp = sector;
+  return status == 0;
+}
+
+// Returns the last dir in the fp, or null if there is a problem
+struct dir 
+*get_last_dir(const char *fp) {
+  block_sector_t sector;
+  char name[NAME_MAX + 1];
+
+  if (strcmp(fp, "") == 0 || !walk_path(fp, &sector, name)
+      || name[0] == '\0') {
+    return NULL;
+  }
+  return dir_open(inode_open(sector));
 }
 
 // fills name with the actual filename, returns false if the name is too long
@@ -249,48 +292,22 @@ get_filename_from_path(const char *fp, char name[NAME_MAX + 2]) {
   return false;
 }
 
-/* Verify the validity of the file path and place the target inode in INODE and enclosing dir in DIR.
-   Return true on success. */
+/* Verify the validity of the file path and place the target inode in INODE.
+   Paths are resolved from the current thread's working directory, so DIR is
+   not used.  Return true on success. */
 bool 
-verify_filepath (const char *fp, struct dir *dir, struct inode **inode) {
-  if (strcmp(fp, "") == 0) {
-    return false;
-  }
+verify_filepath (const char *fp, struct dir *dir UNUSED, struct inode **inode) {
+  block_sector_t sector;
+  char name[NAME_MAX + 1];
+  bool isdir;
 
-  if (dir == NULL) {
-    thread_current()->cwd = dir_open_root();
-    dir = thread_current()->cwd;
-  } else {
-    dir = dir_open(dir_get_inode(thread_current()->cwd));
-  }
-  if (fp[0] == '/') {
-    dir_close(dir);
-    dir = dir_open_root();
-    *inode = dir_get_inode(dir);
+  if (strcmp(fp, "") == 0 || !walk_path(fp, &sector, name)) {
+    return false;
   }
-
-  char name[NAME_MAX + 1];
-  memset(name, 0, NAME_MAX + 1);
-  while (get_next_part(name, &fp)) {
-    bool success = dir_lookup(dir, name, inode);
-    if (success) {
-      if (is_dir(*inode)) {
-        dir_close(dir);
-        dir = dir_open(*inode);
-      } else {
-        if (get_next_part(name, &fp) == 1) {
-          dir_close(dir);
-          return false;  //Error if we path doesn't end but we found a non-dir inode with the same name
-        }   
-        break;  // Break if found the inode
-      }
-    } else {
-      dir_close(dir);
-      return false; //Error if a name does not exist in the path
-    }
+  if (name[0] != '\0' && !dir_lookup_sector(sector, name, &sector, &isdir)) {
+    return false; //Error if a name does not exist in the path
   }
 
-  return true;
+  *inode = inode_open(sector);
+  return *inode != NULL;
 }
-
-
@@ -1,14 +1,49 @@
 #include "filesys/free-map.h"
 #include <bitmap.h>
 #include <debug.h>
+#include <limits.h>
+#include <round.h>
+#include <stdint.h>
+#include <stdio.h>
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "filesys/journal.h"
+#include "threads/malloc.h"
 #include "threads/synch.h"
 
 static struct file *free_map_file;   /* Free map file. */
 static struct lock free_map_lock;
 static struct bitmap *free_map;      /* Free map, one bit per sector. */
+/* Free space index.  The disk is divided into groups of
+   GROUP_SECTORS sectors, and the number of free sectors in each
+   is kept up to date, so that allocation can skip over full
+   groups without looking at their bits. */
+#define GROUP_SECTORS 1024
+static uint16_t *group_free;         /* Free sectors in each group. */
+static size_t cursor;                /* Where the next unhinted search
+                                        begins. */
+
+static struct bitmap *dirty_sectors; /* Free map file sectors changed
+                                        since last written. */
+
+/* Sectors released inside a journal handle stay in use until the
+   transaction that released them commits, so that they cannot be
+   reused while the metadata on disk still points to them. */
+static struct bitmap *pending_release;
+static size_t pending_cnt;           /* Bits set in pending_release. */
+static size_t free_cnt;              /* Sectors free now. */
+
+/* Once fewer sectors than this are free, sectors waiting in
+   pending_release are worth a commit to get back. */
+#define LOW_SPACE 64
+
+/* Statistics. */
+static unsigned long long alloc_cnt;    /* Calls to free_map_allocate_run(). */
+static unsigned long long write_cnt;    /* Free map sectors written. */
+
+static size_t group_cnt (void);
+static void count_groups (void);
 
 /* Initializes the free map. */
 void
@@ -19,49 +54,324 @@ free_map_init (void)
     PANIC ("bitmap creation failed--file system device is too large");
   bitmap_mark (free_map, FREE_MAP_SECTOR);
   bitmap_mark (free_map, ROOT_DIR_SECTOR);
+  bitmap_set_multiple (free_map, JOURNAL_SECTOR, JOURNAL_SECTORS, true);
+
+  dirty_sectors = bitmap_create (DIV_ROUND_UP (bitmap_file_size (free_map),
+                                               BLOCK_SECTOR_SIZE));
+  if (dirty_sectors == NULL)
+    PANIC ("bitmap creation failed--file system device is too large");
+
+  pending_release = bitmap_create (block_size (fs_device));
+  if (pending_release == NULL)
+    PANIC ("bitmap creation failed--file system device is too large");
+  pending_cnt = 0;
+
+  group_free = malloc (group_cnt () * sizeof *group_free);
+  if (group_free == NULL)
+    PANIC ("free space index creation failed");
+  count_groups ();
+  cursor = 0;
 
   lock_init(&free_map_lock);
 }
 
+/* Acquires free_map_lock unless the current thread already holds
+   it, which happens when creating the free map file allocates
+   its sectors.  Returns true if the lock was acquired, in which
+   case unlock_free_map() must release it. */
+static bool
+lock_free_map (void)
+{
+  if (lock_held_by_current_thread (&free_map_lock))
+    return false;
+  lock_acquire (&free_map_lock);
+  return true;
+}
+
+static void
+unlock_free_map (bool acquired)
+{
+  if (acquired)
+    lock_release (&free_map_lock);
+}
+
+/* Records that the bits for the CNT sectors starting at SECTOR
+   have changed.  Caller must hold free_map_lock. */
+static void
+mark_dirty (block_sector_t sector, size_t cnt)
+{
+  size_t first = sector / CHAR_BIT / BLOCK_SECTOR_SIZE;
+  size_t last = (sector + cnt - 1) / CHAR_BIT / BLOCK_SECTOR_SIZE;
+  bitmap_set_multiple (dirty_sectors, first, last - first + 1, true);
+}
+
+/* Writes the sectors of the free map file whose bits have changed
+   since they were last written.  Returns false if one could not
+   be written.  Caller must hold free_map_lock. */
+static bool
+write_free_map (void)
+{
+  if (free_map_file == NULL)
+    return true;
+
+  size_t i = 0;
+  while ((i = bitmap_scan (dirty_sectors, i, 1, true)) != BITMAP_ERROR) {
+    if (!bitmap_write_part (free_map, free_map_file,
+                            i * BLOCK_SECTOR_SIZE, BLOCK_SECTOR_SIZE))
+      return false;
+    bitmap_reset (dirty_sectors, i);
+    write_cnt++;
+  }
+  return true;
+}
+
+/* Number of groups in the free map. */
+static size_t
+group_cnt (void)
+{
+  return DIV_ROUND_UP (bitmap_size (free_map), GROUP_SECTORS);
+}
+
+/* Recomputes the free count of every group from the free map. */
+static void
+count_groups (void)
+{
+  size_t size = bitmap_size (free_map);
+  free_cnt = 0;
+  for (size_t g = 0; g < group_cnt (); g++) {
+    size_t start = g * GROUP_SECTORS;
+    size_t cnt = size - start < GROUP_SECTORS ? size - start : GROUP_SECTORS;
+    group_free[g] = bitmap_count (free_map, start, cnt, false);
+    free_cnt += group_free[g];
+  }
+}
+
+/* Sets the CNT sectors starting at SECTOR, all of which must
+   currently be free if ALLOCATE or in use otherwise, to in use
+   if ALLOCATE or to free otherwise, and keeps the group counts
+   and dirty sectors up to date.  Caller must hold
+   free_map_lock. */
+static void
+set_sectors (block_sector_t sector, size_t cnt, bool allocate)
+{
+  ASSERT (allocate ? bitmap_none (free_map, sector, cnt)
+                   : bitmap_all (free_map, sector, cnt));
+  bitmap_set_multiple (free_map, sector, cnt, allocate);
+  mark_dirty (sector, cnt);
+
+  for (size_t i = sector; i < sector + cnt; ) {
+    size_t g = i / GROUP_SECTORS;
+    size_t end = (g + 1) * GROUP_SECTORS;
+    size_t n = (end < sector + cnt ? end : sector + cnt) - i;
+    if (allocate)
+      group_free[g] -= n;
+    else
+      group_free[g] += n;
+    i += n;
+  }
+  if (allocate)
+    free_cnt -= cnt;
+  else
+    free_cnt += cnt;
+}
+
+/* Returns the first sector of a run of CNT free sectors that
+   begins at or after FROM but before the end of group G, or
+   BITMAP_ERROR if there is none.  The run may extend into the
+   following groups. */
+static size_t
+scan_group (size_t g, size_t from, size_t cnt)
+{
+  size_t size = bitmap_size (free_map);
+  size_t end = (g + 1) * GROUP_SECTORS + cnt - 1;
+
+  return bitmap_scan_range (free_map, from, end < size ? end : size,
+                            cnt, false);
+}
+
+/* Returns the first sector of a run of CNT free sectors, where
+   CNT is at most GROUP_SECTORS.  The search begins at HINT and
+   moves forward a group at a time, wrapping around at the end of
+   the disk.  A group is only scanned if it and the group after it
+   together have CNT free sectors, so on a nearly full disk most
+   groups are passed over by looking at their counts alone.
+   Returns BITMAP_ERROR if there is no such run. */
+static size_t
+find_run (size_t hint, size_t cnt)
+{
+  size_t groups = group_cnt ();
+  size_t g0 = hint / GROUP_SECTORS;
+
+  for (size_t k = 0; k <= groups; k++) {
+    size_t g = (g0 + k) % groups;
+    size_t pair_free = group_free[g] + (g + 1 < groups ? group_free[g + 1] : 0);
+    if (group_free[g] == 0 || pair_free < cnt)
+      continue;
+
+    /* The hint's group is visited twice: first from the hint,
+       and last from its start. */
+    size_t from = k == 0 ? hint : g * GROUP_SECTORS;
+    size_t sector = scan_group (g, from, cnt);
+    if (sector != BITMAP_ERROR)
+      return sector;
+  }
+  return BITMAP_ERROR;
+}
+
+/* Returns where to begin looking for free sectors: at HINT, or
+   at the next-fit cursor if HINT is 0 or out of range. */
+static size_t
+choose_hint (block_sector_t hint)
+{
+  return hint != 0 && hint < bitmap_size (free_map) ? hint : cursor;
+}
+
 /* Allocates CNT consecutive sectors from the free map and stores
    the first into *SECTORP.
    Returns true if successful, false if not enough consecutive
-   sectors were available or if the free_map file could not be
-   written. */
+   sectors were available.  The free map is written back by the
+   next free_map_flush(). */
 bool
 free_map_allocate (size_t cnt, block_sector_t *sectorp)
 { 
-  bool release_lock = false;
-  if (!lock_held_by_current_thread(&free_map_lock)) {
-    lock_acquire(&free_map_lock);
-    release_lock = true;
-  }
-  block_sector_t sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
-  if (sector != BITMAP_ERROR && free_map_file != NULL && !bitmap_write (free_map, free_map_file)) {
-    bitmap_set_multiple (free_map, sector, cnt, false);
-    sector = BITMAP_ERROR;
-  } 
+  ASSERT (cnt > 0 && cnt <= GROUP_SECTORS);
+
+  bool acquired = lock_free_map ();
+  size_t sector = find_run (cursor, cnt);
   if (sector != BITMAP_ERROR) {
+    set_sectors (sector, cnt, true);
+    cursor = sector + cnt < bitmap_size (free_map) ? sector + cnt : 0;
     *sectorp = sector;
   }
-
-  if (release_lock) {
-    lock_release(&free_map_lock);
-  }
+  unlock_free_map (acquired);
 
   return sector != BITMAP_ERROR;
 }
 
+/* Allocates up to CNT consecutive sectors, as close after HINT as
+   possible, and stores the first into *SECTORP.  A HINT of 0
+   means no sector is preferred, and the search continues from
+   where the last one left off.  At most GROUP_SECTORS are
+   allocated at once.  If no run of that many free sectors exists,
+   allocates the free sectors that begin at the first free sector
+   after HINT instead.  Returns the number of sectors allocated,
+   which is 0 only if the disk is full.
+
+   The free map is not written back; the caller must call
+   free_map_flush() once it is done allocating. */
+size_t
+free_map_allocate_run (block_sector_t hint, size_t cnt, block_sector_t *sectorp)
+{
+  ASSERT (cnt > 0);
+  if (cnt > GROUP_SECTORS)
+    cnt = GROUP_SECTORS;
+
+  bool acquired = lock_free_map ();
+  size_t size = bitmap_size (free_map);
+  size_t from = choose_hint (hint);
+
+  size_t sector = find_run (from, cnt);
+  if (sector == BITMAP_ERROR) {
+    sector = find_run (from, 1);
+    if (sector == BITMAP_ERROR) {
+      unlock_free_map (acquired);
+      return 0;
+    }
+    size_t run = 1;
+    while (run < cnt && sector + run < size && !bitmap_test (free_map, sector + run))
+      run++;
+    cnt = run;
+  }
+  set_sectors (sector, cnt, true);
+  cursor = sector + cnt < size ? sector + cnt : 0;
+  alloc_cnt++;
+  unlock_free_map (acquired);
+
+  *sectorp = sector;
+  return cnt;
+}
 
-/* Makes CNT sectors starting at SECTOR available for use. */
+/* Makes CNT sectors starting at SECTOR available for use.  The
+   free map is written back by the next free_map_flush().  Inside a
+   journal handle, the sectors only become available once the
+   handle's transaction commits. */
 void
 free_map_release (block_sector_t sector, size_t cnt)
 {
-  lock_acquire(&free_map_lock);
-  ASSERT (bitmap_all (free_map, sector, cnt));
-  bitmap_set_multiple (free_map, sector, cnt, false);
-  bitmap_write (free_map, free_map_file);
-  lock_release(&free_map_lock);
+  bool acquired = lock_free_map ();
+  if (journal_active ()) {
+    ASSERT (bitmap_all (free_map, sector, cnt));
+    ASSERT (bitmap_none (pending_release, sector, cnt));
+    bitmap_set_multiple (pending_release, sector, cnt, true);
+    pending_cnt += cnt;
+    for (size_t i = 0; i < cnt; i++)
+      journal_revoke (sector + i);
+  } else
+    set_sectors (sector, cnt, false);
+  unlock_free_map (acquired);
+}
+
+/* Releases the sectors whose release was deferred to the commit
+   of the running transaction, and writes back the free map.
+   Called by the journal, in a handle, as the transaction
+   commits. */
+void
+free_map_release_pending (void)
+{
+  bool acquired = lock_free_map ();
+  size_t i = 0;
+  while (pending_cnt > 0
+         && (i = bitmap_scan (pending_release, i, 1, true)) != BITMAP_ERROR) {
+    size_t cnt = 1;
+    while (i + cnt < bitmap_size (pending_release)
+           && bitmap_test (pending_release, i + cnt))
+      cnt++;
+    bitmap_set_multiple (pending_release, i, cnt, false);
+    set_sectors (i, cnt, false);
+    pending_cnt -= cnt;
+    i += cnt;
+  }
+  write_free_map ();
+  unlock_free_map (acquired);
+}
+
+/* Returns true if sectors are waiting to be released when the
+   running transaction commits.  If LOW_ONLY, returns true only if
+   in addition few other sectors are free. */
+bool
+free_map_pending (bool low_only)
+{
+  bool acquired = lock_free_map ();
+  bool pending = pending_cnt > 0 && (!low_only || free_cnt < LOW_SPACE);
+  unlock_free_map (acquired);
+  return pending;
+}
+
+/* Returns the number of sectors in the free map file. */
+size_t
+free_map_file_sectors (void)
+{
+  return DIV_ROUND_UP (bitmap_file_size (free_map), BLOCK_SECTOR_SIZE);
+}
+
+/* Writes back any changes made to the free map.  Only the
+   sectors of the free map file that hold changed bits are
+   written, and they go through the buffer cache, so changes from
+   many allocations reach the disk together. */
+void
+free_map_flush (void)
+{
+  bool acquired = lock_free_map ();
+  write_free_map ();
+  unlock_free_map (acquired);
+}
+
+/* Prints free map statistics. */
+void
+free_map_print_stats (void)
+{
+  printf ("Free map: %llu run allocations, %llu sectors written back\n",
+          alloc_cnt, write_cnt);
 }
 
 /* Opens the free map file and reads it from disk. */
@@ -75,6 +385,7 @@ free_map_open (void)
     PANIC ("can't open free map");
   if (!bitmap_read (free_map, free_map_file))
     PANIC ("can't read free map");
+  count_groups ();
 
   lock_release(&free_map_lock);
 }
@@ -84,11 +395,13 @@ free_map_open (void)
 void
 free_map_close (void)
 { 
+  journal_begin (free_map_file_sectors ());
   lock_acquire(&free_map_lock);
-  if (!bitmap_write (free_map, free_map_file))
+  if (!write_free_map ())
     PANIC ("can't write free map");
   file_close (free_map_file);
   lock_release(&free_map_lock);
+  journal_end ();
 }
 
 /* Creates a new free map file on disk and writes the free map to
@@ -96,6 +409,8 @@ free_map_close (void)
 void
 free_map_create (void)
 {
+  journal_begin (inode_credits (bitmap_file_size (free_map))
+                 + free_map_file_sectors ());
   lock_acquire(&free_map_lock);
 
   /* Create inode. */
@@ -108,9 +423,11 @@ free_map_create (void)
     PANIC ("can't open free map");
   }
   
-  if (!bitmap_write (free_map, free_map_file)) {
+  bitmap_set_all (dirty_sectors, true);
+  if (!write_free_map ()) {
     PANIC ("can't write free map");
   }
 
   lock_release(&free_map_lock);
+  journal_end ();
 }
@@ -12,6 +12,13 @@ void free_map_open (void);
 void free_map_close (void);
 
 bool free_map_allocate (size_t, block_sector_t *);
+size_t free_map_allocate_run (block_sector_t hint, size_t cnt,
+                              block_sector_t *);
 void free_map_release (block_sector_t, size_t);
+void free_map_release_pending (void);
+bool free_map_pending (bool low_only);
+size_t free_map_file_sectors (void);
+void free_map_flush (void);
+void free_map_print_stats (void);
 
 #endif /* filesys/free-map.h */
@@ -1,34 +1,133 @@
 #include "filesys/inode.h"
+#include <hash.h>
 #include <list.h>
 #include <debug.h>
 #include <round.h>
+#include <stat.h>
 #include <string.h>
+#include "filesys/cache.h"
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
+#include "filesys/journal.h"
 #include "threads/malloc.h"
 #include "threads/synch.h"
+#include "threads/thread.h"
 
 /* Identifies an inode. */
 #define INODE_MAGIC 0x494e4f44
 
-#define NUM_POINTERS 128
-#define MAX_FILE_SIZE 512 * 128 * 128
+/* Largest file, in bytes. */
+#define MAX_FILE_SIZE (8 * 1024 * 1024)
 
-static struct list buffer_cache; 
-static struct lock buffer_cache_lock;
+/* Open inodes, so that opening a single inode twice returns the
+   same `struct inode'.  The table is split into stripes by sector
+   number, each with its own lock and hash table, so opens of
+   different inodes rarely wait for each other. */
+#define OPEN_INODE_STRIPES 16
 
-static struct list open_inodes;
-static struct lock open_inodes_lock;
+struct open_inode_stripe {
+  struct lock lock;                     /* Protects index. */
+  struct hash index;                    /* Maps sector to open inode. */
+};
 
+static struct open_inode_stripe open_inodes[OPEN_INODE_STRIPES];
+
+static hash_hash_func open_inode_hash;
+static hash_less_func open_inode_less;
+
+/* Read-ahead.  When an inode is read sequentially, a window of the
+   sectors that follow is queued for the readahead thread, which
+   brings them (and the pointer blocks that lead to them) into the
+   cache.  The window doubles on every sequential read.
+
+   A queued request pins its inode rather than reopening it, so
+   that it does not count as an opener: dir_remove() refuses to
+   remove a directory that others have open, and must not be
+   fooled by read-ahead.  Directories and the free map are not
+   read ahead at all: they are scanned from the start over and
+   over rather than read through once. */
+#define READAHEAD_MIN 4                 /* Initial window, in sectors. */
+#define READAHEAD_MAX 32                /* Largest window, in sectors. */
+#define READAHEAD_QUEUE 16              /* Most requests outstanding. */
+
+/* A queued read-ahead request. */
+struct readahead {
+    struct inode *inode;                /* Pinned for the request. */
+    off_t start;                        /* First byte to prefetch. */
+    off_t end;                          /* Byte past the last to prefetch. */
+};
+
+static struct readahead readahead_queue[READAHEAD_QUEUE];
+static size_t readahead_head;           /* Index of the oldest request. */
+static size_t readahead_cnt;            /* Number of requests queued. */
+static struct lock readahead_lock;      /* Protects the queue. */
+static struct semaphore readahead_pending; /* Upped once per request. */
+
+static thread_func readahead_thread;
+
+/* Byte-range locks.  Each read or write locks the bytes it
+   covers, shared for a read and exclusive for a write, so
+   operations on different parts of a file proceed in parallel.
+   A write that may extend the file locks everything from its
+   offset up to PAST_EOF, so appenders take turns with each other
+   but not with readers of the data already in the file. */
+#define PAST_EOF INT32_MAX
+
+struct inode_range {
+  struct list_elem elem;                /* Element in inode's ranges. */
+  off_t start;                          /* First byte locked. */
+  off_t end;                            /* One past the last byte locked. */
+  bool exclusive;                       /* True for a writer. */
+};
+
+static void lock_range (struct inode *, struct inode_range *,
+                        off_t start, off_t end, bool exclusive);
+static void unlock_range (struct inode *, struct inode_range *);
+
+
+/* Block map layout.  The first DIRECT_CNT sectors of a file are
+   found through pointers in the inode itself, the next
+   PTRS_PER_SECTOR through the indirect block, and the rest
+   through the doubly indirect block. */
+#define DIRECT_CNT 123
+#define PTRS_PER_SECTOR (BLOCK_SECTOR_SIZE / sizeof (block_sector_t))
+#define INDIRECT_START DIRECT_CNT
+#define DOUBLY_INDIRECT_START (INDIRECT_START + PTRS_PER_SECTOR)
+
+/* Set in a data sector pointer when the sector has been allocated
+   to the file but nothing has been written to it yet.  Such a
+   sector reads as zeros, and is not zeroed on disk: its first
+   write fills in the rest of it with zeros in the cache, so the
+   only disk write is of the data itself. */
+#define UNWRITTEN 0x80000000
+
+/* A data sector pointer of 0 is a hole: the file has no sector
+   there, and it reads as zeros.  Seeking past the end of a file
+   and writing leaves a hole in between, and a sector is only
+   allocated for a hole when something is written to it. */
+
+/* Returns true if data sector pointer PTR refers to a sector that
+   holds data, false if it is a hole or UNWRITTEN. */
+static inline bool
+has_data (block_sector_t ptr)
+{
+  return ptr != 0 && !(ptr & UNWRITTEN);
+}
 
 /* On-disk inode.
    Must be exactly BLOCK_SECTOR_SIZE bytes long. */
 struct inode_disk {
-    bool isdir;
-    block_sector_t indirect_ptr_idx;    /* Sector index of indirect pointer. */
     off_t length;                       /* File size in bytes. */
     unsigned magic;                     /* Magic number. */
-    uint32_t unused[124];               /* Not used. */
+    bool isdir;
+    block_sector_t direct[DIRECT_CNT];  /* Data sectors. */
+    block_sector_t indirect;            /* Indirect block, 0 if none. */
+    block_sector_t doubly_indirect;     /* Doubly indirect block, 0 if none. */
+};
+
+/* Indirect or doubly indirect block. */
+struct indirect {
+  block_sector_t ptrs[PTRS_PER_SECTOR];
 };
 
 /* Returns the number of sectors to allocate for an inode SIZE
@@ -39,132 +138,53 @@ bytes_to_sectors (off_t size)
   return DIV_ROUND_UP (size, BLOCK_SECTOR_SIZE);
 }
 
-struct indirect {
-  block_sector_t ptrs[NUM_POINTERS];
-};
-
-/* */
-struct cached_sector {
-	block_sector_t sector_idx; // check against when we go through the cache
-	struct list_elem elem; 
-	bool dirty; 
-	struct lock sector_lock; // acquire if currently reading/writing to this sector
-	char data[BLOCK_SECTOR_SIZE]; // of size BLOCK_SECTOR_SIZE, could be inodedisk or data block, up to caller to cast to correct one
-};
-
-/* Gets the cached_sector from buffer_cache. 
-   If sector_idx isnt present, then we evict the last sector and pull in sector_idx from memory. 
-   During eviction, we write back to memory using block_write if the dirty bit is true. 
-   Aquires the sectors lock and returns a pointer to the sector. 
-   Callers of this function must release sectors lock after done using. */
-struct cached_sector *get_cached_sector(block_sector_t sector_idx, bool is_write) {
-  // look for sector_idx in list
-  struct list_elem *e;
-  struct cached_sector *cs;
-
-  lock_acquire(&buffer_cache_lock);
-
-  if (!list_empty(&buffer_cache)) { // iterate through the list and look for matching sector
-    for (e = list_front(&buffer_cache); e->next != NULL; e = list_next(e)) {
-      cs = list_entry(e, struct cached_sector, elem);
-      if (cs->sector_idx == sector_idx) {
-        lock_release(&buffer_cache_lock);
-        lock_acquire(&cs->sector_lock);
-        // make sure that cs hasn't changed because of an eviction
-        if (cs->sector_idx == sector_idx) {
-          return cs;
-        } 
-        // if it has we need to iterate through the list again to make sure it hasnt been pulled in since
-        lock_release(&cs->sector_lock);
-        return get_cached_sector(sector_idx, is_write);
-      }
-    }
-  }
-
-  // didnt find item in buffer
-  struct cached_sector *new_cs;
-
-  // if theres still size left, we can just create a cached_sector
-  if (list_size(&buffer_cache) < 64) {
-    new_cs = malloc(sizeof(struct cached_sector));
-    lock_init(&new_cs->sector_lock);
-    lock_acquire(&new_cs->sector_lock);
-  } else { // otherwise we grab the last item in the list
-    new_cs = list_entry(list_back(&buffer_cache), struct cached_sector, elem);
-    lock_acquire(&new_cs->sector_lock); // we block until this sector is no longer in use
-    list_remove(&new_cs->elem);
-    if (new_cs->dirty) { // we need to write back to disk
-      block_write (fs_device, new_cs->sector_idx, new_cs->data);
-    }
-  }
-  if (is_write)
-    memset(new_cs->data, 0, BLOCK_SECTOR_SIZE);
-  else
-    block_read(fs_device, sector_idx, new_cs->data);
-  new_cs->sector_idx = sector_idx;
-  new_cs->dirty = 0;
-
-  list_push_front(&buffer_cache, &new_cs->elem);
-  lock_release(&buffer_cache_lock);
-  return new_cs;
-}
-
-// Called from filesys_done
-void write_all_dirty_sectors() {
-  struct cached_sector *cs;
-  struct list_elem *e;
-  lock_acquire(&buffer_cache_lock);
-  
-  for (e = list_front(&buffer_cache); e->next != NULL; e = list_next(e)) {
-    cs = list_entry(e, struct cached_sector, elem);
-    if (cs->dirty) {
-      block_write (fs_device, cs->sector_idx, cs->data);
-      cs->dirty = 0;
-    }
-  }
-
-  lock_release(&buffer_cache_lock);
-}
-
-// writes buffer into c->data. buffer must be size SIZE.
-// Only called when we don't want to write the whole block sector (e.g. inode_write_at)
-// Also called in cache_write with args SIZE = BLOCK_SECTOR_SIZE and SECTOR_OFS = 0
-void cache_write_with_size_and_offset(block_sector_t sector_idx, void *buffer, size_t size, size_t sector_ofs) {
-  ASSERT(sector_ofs + size <= BLOCK_SECTOR_SIZE);
-
-  struct cached_sector *cs = get_cached_sector(sector_idx, true);
-  char *buff = buffer;
-  for (size_t i = 0; i < size; i++) {
-    cs->data[i + sector_ofs] = buff[i];
-  }
-  cs->dirty = 1;
-  lock_release(&cs->sector_lock);
+/* Returns the most sectors of a file's inode and pointer blocks
+   that allocating or freeing SIZE bytes of it can change: the
+   inode, the indirect and doubly indirect blocks, and the
+   indirect blocks under the doubly indirect block that map the
+   bytes.  This is what a journal handle that changes that much of
+   a file must reserve. */
+size_t
+inode_credits (off_t size)
+{
+  return 3 + DIV_ROUND_UP (bytes_to_sectors (size), PTRS_PER_SECTOR) + 1;
 }
 
-void cache_write(block_sector_t sector_idx, void *buffer) {
-  cache_write_with_size_and_offset(sector_idx, buffer, BLOCK_SECTOR_SIZE, 0);
+/* Returns true if INODE holds metadata, a directory or the free
+   map, whose contents are journaled along with the inodes and
+   pointer blocks. */
+static bool
+is_metadata (const struct inode *inode)
+{
+  return inode->isdir || inode->sector == FREE_MAP_SECTOR;
 }
 
-// writes c->data into buffer. buffer must be atleast size SIZE.
-// Only called when we don't want to read the whole block sector (e.g. inode_read_at)
-// Also called in cache_read with args SIZE = BLOCK_SECTOR_SIZE and SECTOR_OFS = 0
-void cache_read_with_size_and_offset(block_sector_t sector_idx, void *buffer, size_t size, size_t sector_ofs) {
-  ASSERT(sector_ofs + size <= BLOCK_SECTOR_SIZE);
-  struct cached_sector *cs = get_cached_sector(sector_idx, false);
-  char *buff = buffer;
-  for (size_t i = 0; i < size; i++) {
-    buff[i] = cs->data[i + sector_ofs];
-  }
-  lock_release(&cs->sector_lock);
+/* Writes SIZE bytes from BUFFER into SECTOR, which holds data of
+   INODE, starting at SECTOR_OFS. */
+static void
+write_data (const struct inode *inode, block_sector_t sector,
+            const void *buffer, size_t size, size_t sector_ofs)
+{
+  if (is_metadata (inode))
+    cache_write_metadata (sector, buffer, size, sector_ofs);
+  else
+    cache_write_with_size_and_offset (sector, buffer, size, sector_ofs,
+                                      inode->sector);
 }
 
-// 
-void cache_read(block_sector_t sector_idx, void *buffer) {
-  cache_read_with_size_and_offset(sector_idx, buffer, BLOCK_SECTOR_SIZE, 0);
+/* Returns entry IDX of pointer block SECTOR. */
+static block_sector_t
+read_ptr (block_sector_t sector, size_t idx)
+{
+  struct cached_sector *cs = cache_acquire (sector, false);
+  block_sector_t result = ((const struct indirect *) cache_read_data (cs))->ptrs[idx];
+  cache_release (cs);
+  return result;
 }
 
 /* Returns the block device sector that contains byte offset POS
-   within INODE.
+   within INODE, with UNWRITTEN set if it has not been written,
+   or 0 if POS is in a hole.
    Returns -1 if INODE does not contain data for a byte at offset
    POS. */
 static block_sector_t
@@ -172,142 +192,278 @@ byte_to_sector (const struct inode *inode, off_t pos)
 {
   ASSERT (inode != NULL);
 
-  struct inode_disk *disk_inode = calloc(1, sizeof(struct inode_disk));
-  
-  cache_read(inode->sector, disk_inode);
-  
-  if (pos < disk_inode->length) {
-    struct indirect *doubly_indirect_ptr = calloc(1, sizeof(struct indirect));
-    struct indirect *indirect_ptr = calloc(1, sizeof(struct indirect));
-
-    int level1_position = (pos / BLOCK_SECTOR_SIZE) / NUM_POINTERS;
-    int level2_position = (pos / BLOCK_SECTOR_SIZE) % NUM_POINTERS;
-
-    cache_read(disk_inode->indirect_ptr_idx, doubly_indirect_ptr);
-    cache_read(doubly_indirect_ptr->ptrs[level1_position], indirect_ptr);
-
-    block_sector_t result = indirect_ptr->ptrs[level2_position];
+  if (pos >= inode->length)
+    return -1;
+
+  size_t idx = pos / BLOCK_SECTOR_SIZE;
+  struct cached_sector *cs = cache_acquire (inode->sector, false);
+  const struct inode_disk *disk_inode = cache_read_data (cs);
+  block_sector_t result;
+  if (idx < INDIRECT_START)
+    result = disk_inode->direct[idx];
+  else if (idx < DOUBLY_INDIRECT_START)
+    result = disk_inode->indirect;
+  else
+    result = disk_inode->doubly_indirect;
+  cache_release (cs);
 
-    free(disk_inode);
-    free(doubly_indirect_ptr);
-    free(indirect_ptr);
-    return result;
-  }
-    
-  free(disk_inode);
-  return -1;
+  if (result == 0)
+    return 0;
+  if (idx >= DOUBLY_INDIRECT_START) {
+    idx -= DOUBLY_INDIRECT_START;
+    result = read_ptr (result, idx / PTRS_PER_SECTOR);
+    if (result != 0)
+      result = read_ptr (result, idx % PTRS_PER_SECTOR);
+  } else if (idx >= INDIRECT_START)
+    result = read_ptr (result, idx - INDIRECT_START);
+  return result;
 }
 
-/* List of open inodes, so that opening a single inode twice
-   returns the same `struct inode'. */
 
 /* Initializes the inode module and buffer cache. */
 void
 inode_init (void) {
-  list_init (&open_inodes);
-  lock_init(&open_inodes_lock);
+  for (int i = 0; i < OPEN_INODE_STRIPES; i++) {
+    lock_init (&open_inodes[i].lock);
+    hash_init (&open_inodes[i].index, open_inode_hash, open_inode_less, NULL);
+  }
 
-  list_init (&buffer_cache);
-  lock_init(&buffer_cache_lock);
+  cache_init ();
+
+  lock_init (&readahead_lock);
+  sema_init (&readahead_pending, 0);
+  thread_create ("readahead", PRI_DEFAULT, readahead_thread, NULL);
 }
 
-/* Allocates and appends a new data sector to the end of the file */
-/* Creates indirect pointers as needed. Returns sector number of allocated data sector. */
-/* Returns 0 on failure */
-bool add_sector_to_file(struct inode_disk *disk_inode, block_sector_t *sector) {
-  static char zeros[BLOCK_SECTOR_SIZE];
-  if (free_map_allocate(1, sector)) {
-    cache_write(*sector, zeros);
-    return true;
+/* Sets entry IDX of pointer block SECTOR to VALUE. */
+static void
+write_ptr (block_sector_t sector, size_t idx, block_sector_t value)
+{
+  struct cached_sector *cs = cache_acquire (sector, false);
+  ((struct indirect *) cache_write_data (cs))->ptrs[idx] = value;
+  cache_release (cs);
+}
+
+/* Marks file sector IDX of INODE, which is SECTOR, as written.
+   The pointer blocks that lead to it must already exist. */
+static void
+mark_written (struct inode *inode, size_t idx, block_sector_t sector)
+{
+  struct cached_sector *cs = cache_acquire (inode->sector, false);
+  if (idx < INDIRECT_START) {
+    ((struct inode_disk *) cache_write_data (cs))->direct[idx] = sector;
+    cache_release (cs);
+    return;
+  }
+  const struct inode_disk *disk_inode = cache_read_data (cs);
+  block_sector_t indirect = disk_inode->indirect;
+  block_sector_t doubly_indirect = disk_inode->doubly_indirect;
+  cache_release (cs);
+
+  if (idx < DOUBLY_INDIRECT_START)
+    write_ptr (indirect, idx - INDIRECT_START, sector);
+  else {
+    idx -= DOUBLY_INDIRECT_START;
+    write_ptr (read_ptr (doubly_indirect, idx / PTRS_PER_SECTOR),
+               idx % PTRS_PER_SECTOR, sector);
   }
-  return false;
 }
 
-/* Resizes file. Rolls back actions if allocation fails. */
-bool inode_resize(struct inode_disk *disk_inode, off_t size) {
-  struct indirect *doubly_indirect_ptr = calloc(1, sizeof(struct indirect));
-  struct indirect *indirect_ptr = calloc(1, sizeof(struct indirect));
+/* If *SECTOR is 0, allocates an empty pointer block near HINT
+   and stores its sector number in *SECTOR.  Returns false if
+   allocation fails. */
+static bool
+alloc_ptr_block (block_sector_t *sector, block_sector_t hint)
+{
+  if (*sector != 0)
+    return true;
+  if (free_map_allocate_run (hint, 1, sector) == 0)
+    return false;
+  /* The sector may still be cached from a file that freed it. */
+  struct cached_sector *cs = cache_acquire (*sector, true);
+  memset (cache_write_data (cs), 0, BLOCK_SECTOR_SIZE);
+  cache_release (cs);
+  return true;
+}
 
-  if (disk_inode->indirect_ptr_idx == 0 && size == 0) {
-    free(doubly_indirect_ptr);
-    free(indirect_ptr);
+/* Returns the sector holding file sector IDX of DISK_INODE, or 0
+   if there is none. */
+static block_sector_t
+get_block (const struct inode_disk *disk_inode, size_t idx)
+{
+  if (idx < INDIRECT_START)
+    return disk_inode->direct[idx];
+  if (idx < DOUBLY_INDIRECT_START)
+    return disk_inode->indirect ? read_ptr (disk_inode->indirect, idx - INDIRECT_START) : 0;
+
+  idx -= DOUBLY_INDIRECT_START;
+  if (disk_inode->doubly_indirect == 0)
+    return 0;
+  block_sector_t l1 = read_ptr (disk_inode->doubly_indirect, idx / PTRS_PER_SECTOR);
+  return l1 ? read_ptr (l1, idx % PTRS_PER_SECTOR) : 0;
+}
+
+/* Makes SECTOR hold file sector IDX of DISK_INODE, allocating
+   pointer blocks on the way as needed.  Returns false if a
+   pointer block cannot be allocated. */
+static bool
+set_block (struct inode_disk *disk_inode, size_t idx, block_sector_t sector)
+{
+  block_sector_t hint = sector & ~UNWRITTEN;
+
+  if (idx < INDIRECT_START) {
+    disk_inode->direct[idx] = sector;
+    return true;
+  }
+  if (idx < DOUBLY_INDIRECT_START) {
+    if (!alloc_ptr_block (&disk_inode->indirect, hint))
+      return false;
+    write_ptr (disk_inode->indirect, idx - INDIRECT_START, sector);
     return true;
   }
 
-  size_t original_length = disk_inode->length;
-  
-  if (disk_inode->indirect_ptr_idx == 0) {
-    if (!add_sector_to_file(disk_inode, &disk_inode->indirect_ptr_idx)) {
-      free(doubly_indirect_ptr);
-      free(indirect_ptr);
-      inode_resize(disk_inode, original_length);
+  idx -= DOUBLY_INDIRECT_START;
+  if (!alloc_ptr_block (&disk_inode->doubly_indirect, hint))
+    return false;
+  block_sector_t l1 = read_ptr (disk_inode->doubly_indirect, idx / PTRS_PER_SECTOR);
+  if (l1 == 0) {
+    if (!alloc_ptr_block (&l1, hint))
       return false;
-    }
+    write_ptr (disk_inode->doubly_indirect, idx / PTRS_PER_SECTOR, l1);
   }
+  write_ptr (l1, idx % PTRS_PER_SECTOR, sector);
+  return true;
+}
 
-  cache_read(disk_inode->indirect_ptr_idx, doubly_indirect_ptr);
-  
-  // Loop through level 1 pointers
-  for (int i = 0; i < NUM_POINTERS; i++) {  
-    
-    // Allocate a singly indirect sector if we need one
-    if (size > i * (BLOCK_SECTOR_SIZE * NUM_POINTERS) && doubly_indirect_ptr->ptrs[i] == 0) {
-      if (!add_sector_to_file(disk_inode, &doubly_indirect_ptr->ptrs[i])) {
-        free(doubly_indirect_ptr);
-        free(indirect_ptr);
-        inode_resize(disk_inode, original_length);
-        return false;
-      }
+/* Returns true if shrinking a file to NEW_SECTORS frees the
+   pointer block that maps file sector IDX. */
+static bool
+ptr_block_freed (size_t new_sectors, size_t idx)
+{
+  if (idx < INDIRECT_START)
+    return false;
+  if (idx < DOUBLY_INDIRECT_START)
+    return new_sectors <= INDIRECT_START;
+  size_t keep = new_sectors > DOUBLY_INDIRECT_START
+                ? DIV_ROUND_UP (new_sectors - DOUBLY_INDIRECT_START, PTRS_PER_SECTOR)
+                : 0;
+  return (idx - DOUBLY_INDIRECT_START) / PTRS_PER_SECTOR >= keep;
+}
+
+/* Frees the data sectors of DISK_INODE from file sector
+   NEW_SECTORS up to OLD_SECTORS, then any pointer blocks that no
+   longer map anything.  Entries in pointer blocks that are freed
+   are left as they are, rather than changing, and journaling, a
+   block that is about to be thrown away. */
+static void
+shrink_blocks (struct inode_disk *disk_inode, size_t old_sectors,
+               size_t new_sectors)
+{
+  for (size_t idx = new_sectors; idx < old_sectors; idx++) {
+    block_sector_t sector = get_block (disk_inode, idx);
+    if (sector != 0) {
+      free_map_release (sector & ~UNWRITTEN, 1);
+      if (!ptr_block_freed (new_sectors, idx))
+        set_block (disk_inode, idx, 0);
     }
+  }
 
-    if (doubly_indirect_ptr->ptrs[i] != 0) {
-    
-      cache_read(doubly_indirect_ptr->ptrs[i], indirect_ptr);
-    // Loop through the level 2 pointers
-      for (int j = 0; j < NUM_POINTERS; j++) {        
-        // Allocate a data sector if we need one
-        if (size > i * (BLOCK_SECTOR_SIZE * NUM_POINTERS) + j * (BLOCK_SECTOR_SIZE) && indirect_ptr->ptrs[j] == 0) {
-          if (!add_sector_to_file(disk_inode, &indirect_ptr->ptrs[j])) {
-            free(doubly_indirect_ptr);
-            free(indirect_ptr);
-            inode_resize(disk_inode, original_length);
-            return false;
-          }
-        }
-        
-        // Delete a data sector if the file is too large
-        if (size <= i * (BLOCK_SECTOR_SIZE * NUM_POINTERS) + j * (BLOCK_SECTOR_SIZE) && indirect_ptr->ptrs[j] != 0) {
-          free_map_release(indirect_ptr->ptrs[j], 1);
-          indirect_ptr->ptrs[j] = 0;
-        }
-        
+  if (new_sectors <= INDIRECT_START && disk_inode->indirect != 0) {
+    free_map_release (disk_inode->indirect, 1);
+    disk_inode->indirect = 0;
+  }
+  if (disk_inode->doubly_indirect != 0) {
+    size_t keep = new_sectors > DOUBLY_INDIRECT_START
+                  ? DIV_ROUND_UP (new_sectors - DOUBLY_INDIRECT_START, PTRS_PER_SECTOR)
+                  : 0;
+    for (size_t i = keep; i < PTRS_PER_SECTOR; i++) {
+      block_sector_t l1 = read_ptr (disk_inode->doubly_indirect, i);
+      if (l1 != 0) {
+        free_map_release (l1, 1);
+        if (keep > 0)
+          write_ptr (disk_inode->doubly_indirect, i, 0);
       }
-      // Commit the singly indirect pointer into disk
-      cache_write(doubly_indirect_ptr->ptrs[i], indirect_ptr);
     }
-    
-    // Delete a singly indirect pointer if the file is too large
-    if (size <= i * (BLOCK_SECTOR_SIZE * NUM_POINTERS) && doubly_indirect_ptr->ptrs[i] != 0) {
-      free_map_release(doubly_indirect_ptr->ptrs[i], 1);
-      doubly_indirect_ptr->ptrs[i] = 0;
+    if (keep == 0) {
+      free_map_release (disk_inode->doubly_indirect, 1);
+      disk_inode->doubly_indirect = 0;
     }
   }
+}
 
-  cache_write(disk_inode->indirect_ptr_idx, doubly_indirect_ptr);
-
-  if (size == 0) {
-    free_map_release(disk_inode->indirect_ptr_idx, 1);
-    disk_inode->indirect_ptr_idx = 0;
-  }
+/* Returns where to look for a sector to hold file sector IDX of
+   DISK_INODE, whose inode is in sector INODE_SECTOR: just after
+   the sector that holds file sector IDX - 1, or just after the
+   inode if there is none. */
+static block_sector_t
+block_hint (const struct inode_disk *disk_inode, block_sector_t inode_sector,
+            size_t idx)
+{
+  block_sector_t prev = idx > 0 ? get_block (disk_inode, idx - 1) : 0;
+  return (prev != 0 ? prev & ~UNWRITTEN : inode_sector) + 1;
+}
 
-  disk_inode->length = size;
+/* Allocates data sectors for DISK_INODE, whose inode is in
+   sector INODE_SECTOR, from file sector FIRST up to NEW_SECTORS,
+   and marks them UNWRITTEN.  Sectors are taken in runs that
+   continue on from the sector before FIRST, or from the inode if
+   there is none.  Returns false if the disk fills up, leaving
+   whatever was allocated in place. */
+static bool
+grow_blocks (struct inode_disk *disk_inode, block_sector_t inode_sector,
+             size_t first, size_t new_sectors)
+{
+  block_sector_t hint = block_hint (disk_inode, inode_sector, first);
 
-  free(doubly_indirect_ptr);
-  free(indirect_ptr);
+  while (first < new_sectors) {
+    block_sector_t start;
+    size_t run = free_map_allocate_run (hint, new_sectors - first, &start);
+    if (run == 0)
+      return false;
+    hint = start + run;
 
+    for (size_t i = 0; i < run; i++) {
+      if (!set_block (disk_inode, first, (start + i) | UNWRITTEN)) {
+        free_map_release (start + i, run - i);
+        return false;
+      }
+      first++;
+    }
+  }
   return true;
 }
 
+/* Resizes file, whose inode is in sector INODE_SECTOR.  When the
+   file grows, sectors are allocated only for the bytes from
+   ALLOC_FROM on; any new bytes before that are left as a hole.
+   Rolls back actions if allocation fails.  Writes the free map
+   back once, at the end. */
+bool inode_resize(struct inode_disk *disk_inode, block_sector_t inode_sector,
+                  off_t size, off_t alloc_from) {
+  size_t old_sectors = bytes_to_sectors (disk_inode->length);
+  size_t new_sectors = bytes_to_sectors (size);
+  size_t first = alloc_from / BLOCK_SECTOR_SIZE;
+  bool success = true;
+
+  if (size > MAX_FILE_SIZE)
+    return false;
+
+  if (new_sectors >= old_sectors) {
+    if (first < old_sectors)
+      first = old_sectors;
+    if (!grow_blocks (disk_inode, inode_sector, first, new_sectors)) {
+      shrink_blocks (disk_inode, new_sectors, old_sectors);
+      success = false;
+    }
+  } else
+    shrink_blocks (disk_inode, old_sectors, new_sectors);
+
+  if (success)
+    disk_inode->length = size;
+  free_map_flush ();
+  return success;
+}
+
 /* Initializes an inode with LENGTH bytes of data and
    writes the new inode to sector SECTOR on the file system
    device.
@@ -317,7 +473,6 @@ bool
 inode_create (block_sector_t sector, off_t length)
 {
   struct inode_disk *disk_inode = calloc(1, sizeof(struct inode_disk));
-  struct indirect *doubly_indirect_ptr = calloc(1, sizeof(struct indirect));
   bool success = false;
 
   ASSERT (length >= 0);
@@ -326,24 +481,14 @@ inode_create (block_sector_t sector, off_t length)
      one sector in size, and you should fix that. */
   ASSERT (sizeof *disk_inode == BLOCK_SECTOR_SIZE);
 
-  if (disk_inode != NULL && doubly_indirect_ptr != NULL)
+  if (disk_inode != NULL)
     {
-      disk_inode->magic = INODE_MAGIC; 
-      
-      if (free_map_allocate(1, &disk_inode->indirect_ptr_idx))
+      disk_inode->magic = INODE_MAGIC;
+      if (inode_resize(disk_inode, sector, length, 0))
         {
-          cache_write(disk_inode->indirect_ptr_idx, doubly_indirect_ptr);
-          if (length > 0) {
-             if (!inode_resize(disk_inode, length)) {
-               free (doubly_indirect_ptr);
-               free (disk_inode);
-               return false;
-             }
-          }
           cache_write (sector, disk_inode);
           success = true;
         }
-      free (doubly_indirect_ptr);
       free (disk_inode);
     }
   return success;
@@ -362,60 +507,98 @@ inode_create_dir (block_sector_t sector, off_t length) {
   return success;
 }
 
+/* Returns a hash value for the inode containing E. */
+static unsigned
+open_inode_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  return hash_int (hash_entry (e, struct inode, elem)->sector);
+}
+
+/* Returns true if inode A precedes inode B. */
+static bool
+open_inode_less (const struct hash_elem *a, const struct hash_elem *b,
+                 void *aux UNUSED)
+{
+  return (hash_entry (a, struct inode, elem)->sector
+          < hash_entry (b, struct inode, elem)->sector);
+}
+
+/* Returns the stripe of the open inode table that holds the inode
+   in SECTOR. */
+static struct open_inode_stripe *
+open_inode_stripe (block_sector_t sector)
+{
+  return &open_inodes[sector % OPEN_INODE_STRIPES];
+}
+
 /* Reads an inode from SECTOR
    and returns a `struct inode' that contains it.
-   Returns a null pointer if memory allocation fails. */
+   Returns a null pointer if memory allocation fails.
+
+   A new inode goes into the open inode table before its sector is
+   read, so that the stripe's lock is not held across disk I/O.
+   The opener holds the inode's map_lock until the length and type
+   are loaded, and anyone who finds the inode in the table waits
+   for that lock before using it. */
 struct inode *
 inode_open (block_sector_t sector)
 {
-  struct list_elem *e;
+  struct open_inode_stripe *stripe = open_inode_stripe (sector);
   struct inode *inode;
+  struct inode key;
+  struct hash_elem *e;
 
   /* Check whether this inode is already open. */
-  lock_acquire(&open_inodes_lock);
-
-
-  for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
-       e = list_next (e))
+  lock_acquire(&stripe->lock);
+  key.sector = sector;
+  e = hash_find (&stripe->index, &key.elem);
+  if (e != NULL)
     {
-
-      inode = list_entry (e, struct inode, elem);
-      if (inode->sector == sector)
-        {
-          lock_release(&open_inodes_lock);
-
-          inode_reopen (inode);
-
-          return inode;
-        }
+      /* Still holding the stripe's lock, so that inode_close()
+         cannot free the inode first. */
+      inode = inode_reopen (hash_entry (e, struct inode, elem));
+      lock_release(&stripe->lock);
+
+      /* Wait until its opener has loaded it. */
+      lock_acquire (&inode->map_lock);
+      lock_release (&inode->map_lock);
+      return inode;
     }
 
-
   /* Allocate memory. */
   inode = malloc (sizeof *inode);
-  if (inode == NULL)
+  if (inode == NULL) {
+    lock_release(&stripe->lock);
     return NULL;
+  }
 
   /* Initialize. */
-  list_push_front (&open_inodes, &inode->elem);
-
-  cond_init(&(inode->ok_to_read));
-  cond_init(&(inode->ok_to_write));
   lock_init(&(inode->l));
+  list_init (&inode->ranges);
+  cond_init (&inode->range_released);
   lock_init(&(inode->dir_lock));
+  lock_init(&inode->map_lock);
 
 
   inode->sector = sector;
   inode->open_cnt = 1;
+  inode->pin_cnt = 0;
   inode->deny_write_cnt = 0;
   inode->removed = false;
-  
-  inode->active_writers = 0;
-  inode->active_readers = 0;
-  inode->waiting_writers = 0;
-  inode->waiting_readers = 0;
-  
-  lock_release(&open_inodes_lock);
+  inode->ra_next = 0;
+  inode->ra_end = 0;
+  inode->ra_window = 0;
+
+  lock_acquire (&inode->map_lock);
+  hash_insert (&stripe->index, &inode->elem);
+  lock_release(&stripe->lock);
+
+  struct cached_sector *cs = cache_acquire (sector, false);
+  const struct inode_disk *disk_inode = cache_read_data (cs);
+  inode->length = disk_inode->length;
+  inode->isdir = disk_inode->isdir;
+  cache_release (cs);
+  lock_release (&inode->map_lock);
 
   return inode;
 }
@@ -425,9 +608,9 @@ struct inode *
 inode_reopen (struct inode *inode)
 {
   if (inode != NULL) {
-    writer_checkin(inode);
+    lock_acquire(&inode->l);
     inode->open_cnt++;
-    writer_checkout(inode);
+    lock_release(&inode->l);
   }
   return inode;
 }
@@ -442,13 +625,31 @@ inode_get_inumber (const struct inode *inode)
 void free_all_data_sectors(struct inode *inode) {
   struct inode_disk *disk_inode = calloc(1, sizeof(struct inode_disk));
   cache_read(inode->sector, disk_inode);
-  inode_resize(disk_inode, 0);
+  inode_resize(disk_inode, inode->sector, 0, 0);
   free(disk_inode);
 }
 
+/* Frees INODE, which is no longer open or pinned, and its blocks
+   if it was removed. */
+static void
+release_inode (struct inode *inode)
+{
+  if (inode->removed)
+    {
+      journal_begin (inode_credits (inode->length));
+      free_all_data_sectors(inode);
+      free_map_release (inode->sector, 1);
+      free_map_flush ();
+      journal_end ();
+    }
+  free (inode);
+}
+
 /* Closes INODE and writes it to disk.
    If this was the last reference to INODE, frees its memory.
-   If INODE was also a removed inode, frees its blocks. */
+   If INODE was also a removed inode, frees its blocks.  If a
+   read-ahead request still pins INODE, that is left to
+   inode_unpin(). */
 void
 inode_close (struct inode *inode)
 {
@@ -456,26 +657,43 @@ inode_close (struct inode *inode)
   if (inode == NULL)
     return;
 
-  /* Release resources if this was the last opener. */
-  writer_checkin(inode);
-  if (--inode->open_cnt == 0)
-    {
-      /* Remove from inode list and release lock. */
-      lock_acquire(&open_inodes_lock);
-      list_remove (&inode->elem);
-      lock_release(&open_inodes_lock);
+  /* Release resources if this was the last opener.  Holding the
+     stripe's lock keeps inode_open() from reopening the inode once
+     its count reaches zero. */
+  struct open_inode_stripe *stripe = open_inode_stripe (inode->sector);
+  lock_acquire(&stripe->lock);
+  lock_acquire(&inode->l);
+  bool last = --inode->open_cnt == 0;
+  bool release = last && inode->pin_cnt == 0;
+  lock_release(&inode->l);
+  if (last)
+    hash_delete (&stripe->index, &inode->elem);
+  lock_release(&stripe->lock);
+
+  if (release)
+    release_inode (inode);
+}
 
-      /* Deallocate blocks if removed. */
-      if (inode->removed)
-        {
-          free_all_data_sectors(inode);
-          free_map_release (inode->sector, 1);
-        }
-      writer_checkout(inode); // Kinda redundant since we free anyway
-      free (inode);
-    } else {
-      writer_checkout(inode);
-    }
+/* Pins INODE in memory for a read-ahead request. */
+static void
+inode_pin (struct inode *inode)
+{
+  lock_acquire (&inode->l);
+  inode->pin_cnt++;
+  lock_release (&inode->l);
+}
+
+/* Unpins INODE, releasing it if it has been closed by its last
+   opener meanwhile. */
+static void
+inode_unpin (struct inode *inode)
+{
+  lock_acquire (&inode->l);
+  bool release = --inode->pin_cnt == 0 && inode->open_cnt == 0;
+  lock_release (&inode->l);
+
+  if (release)
+    release_inode (inode);
 }
 
 /* Marks INODE to be deleted when it is closed by the last caller who
@@ -483,10 +701,99 @@ inode_close (struct inode *inode)
 void
 inode_remove (struct inode *inode)
 {
-  writer_checkin(inode);
   ASSERT (inode != NULL);
+  lock_acquire(&inode->l);
   inode->removed = true;
-  writer_checkout(inode);
+  lock_release(&inode->l);
+}
+
+/* Queues the bytes of INODE from START up to END for the
+   readahead thread.  The request is dropped if the queue is
+   full. */
+static void
+queue_readahead (struct inode *inode, off_t start, off_t end)
+{
+  lock_acquire (&readahead_lock);
+  if (readahead_cnt < READAHEAD_QUEUE) {
+    struct readahead *ra =
+      &readahead_queue[(readahead_head + readahead_cnt++) % READAHEAD_QUEUE];
+    inode_pin (inode);
+    ra->inode = inode;
+    ra->start = start;
+    ra->end = end;
+    sema_up (&readahead_pending);
+  }
+  lock_release (&readahead_lock);
+}
+
+/* Readahead thread.  Brings the sectors of each queued request
+   into the cache, unless its inode has been removed, then unpins
+   the request's inode. */
+static void
+readahead_thread (void *aux UNUSED)
+{
+  for (;;) {
+    sema_down (&readahead_pending);
+
+    lock_acquire (&readahead_lock);
+    struct readahead ra = readahead_queue[readahead_head];
+    readahead_head = (readahead_head + 1) % READAHEAD_QUEUE;
+    readahead_cnt--;
+    lock_release (&readahead_lock);
+
+    if (!ra.inode->removed) {
+      struct inode_range range;
+      lock_range (ra.inode, &range, ra.start, ra.end, false);
+      for (off_t ofs = ra.start; ofs < ra.end; ofs += BLOCK_SECTOR_SIZE) {
+        block_sector_t sector_idx = byte_to_sector (ra.inode, ofs);
+        if (sector_idx == (block_sector_t) -1)
+          break;
+        if (has_data (sector_idx))
+          cache_prefetch (sector_idx);
+      }
+      unlock_range (ra.inode, &range);
+    }
+    inode_unpin (ra.inode);
+  }
+}
+
+/* Updates INODE's read-ahead state for a read of the bytes from
+   START up to END, and queues read-ahead if the reads so far look
+   sequential.  Read-ahead is only queued again once half of the
+   window has been consumed, so small reads do not each queue a
+   request. */
+static void
+update_readahead (struct inode *inode, off_t start, off_t end)
+{
+  if (is_metadata (inode))
+    return;
+
+  if (start != inode->ra_next || start == 0) {
+    /* Not (yet) sequential: forget any earlier window. */
+    inode->ra_window = start == 0 ? READAHEAD_MIN : 0;
+    inode->ra_end = end;
+  } else if (inode->ra_window < READAHEAD_MAX) {
+    inode->ra_window = inode->ra_window ? inode->ra_window * 2 : READAHEAD_MIN;
+    if (inode->ra_window > READAHEAD_MAX)
+      inode->ra_window = READAHEAD_MAX;
+  }
+  inode->ra_next = end;
+
+  if (inode->ra_window == 0)
+    return;
+  off_t window = inode->ra_window * BLOCK_SECTOR_SIZE;
+  if (inode->ra_end - end >= window / 2)
+    return;
+
+  off_t ra_start = inode->ra_end > end ? inode->ra_end : end;
+  off_t ra_end = end + window;
+  off_t length = inode_length (inode);
+  if (ra_end > length)
+    ra_end = length;
+  if (ra_start >= ra_end)
+    return;
+  inode->ra_end = ra_end;
+  queue_readahead (inode, ROUND_DOWN (ra_start, BLOCK_SECTOR_SIZE), ra_end);
 }
 
 /* Reads SIZE bytes from INODE into BUFFER, starting at position OFFSET.
@@ -497,8 +804,11 @@ inode_read_at (struct inode *inode, void *buffer_, size_t size, size_t offset)
 {
   uint8_t *buffer = buffer_;
   off_t bytes_read = 0;
+  struct inode_range range;
 
-  reader_checkin(inode);
+  lock_range (inode, &range, offset,
+              size < (size_t) PAST_EOF - offset ? offset + size : PAST_EOF,
+              false);
 
   while (size > 0)
     {
@@ -519,7 +829,10 @@ inode_read_at (struct inode *inode, void *buffer_, size_t size, size_t offset)
       if (chunk_size <= 0)
         break;
 
-      cache_read_with_size_and_offset(sector_idx, buffer + bytes_read, chunk_size, sector_ofs);
+      if (!has_data (sector_idx))
+        memset (buffer + bytes_read, 0, chunk_size);
+      else
+        cache_read_with_size_and_offset(sector_idx, buffer + bytes_read, chunk_size, sector_ofs);
       
       /* Advance. */
       size -= chunk_size;
@@ -527,11 +840,165 @@ inode_read_at (struct inode *inode, void *buffer_, size_t size, size_t offset)
       bytes_read += chunk_size;
     }
     
-  reader_checkout(inode);
+  unlock_range (inode, &range);
+
+  if (bytes_read > 0)
+    update_readahead (inode, offset - bytes_read, offset);
 
   return bytes_read;
 }
 
+/* Pins the sector that holds byte offset OFFSET of INODE in the
+   buffer cache and returns it, or returns a null pointer if
+   OFFSET is past the end of INODE or in a sector that has not
+   been written.  The caller reads the sector in place with
+   cache_read_data() and releases it with cache_release().  Unlike
+   inode_read_at(), this takes no byte range lock, so the caller
+   must keep writers out itself, as directories do with their
+   dir_lock. */
+struct cached_sector *
+inode_acquire_sector (struct inode *inode, off_t offset)
+{
+  block_sector_t sector_idx = byte_to_sector (inode, offset);
+  if (sector_idx == (block_sector_t) -1 || !has_data (sector_idx))
+    return NULL;
+  return cache_acquire (sector_idx, false);
+}
+
+/* Allocates a sector for the hole at file sector IDX of INODE,
+   next to the sector before it if possible.  Returns the sector,
+   which is not yet in INODE's block map, or 0 if the disk is
+   full.  The inode is copied out of the cache first, because
+   finding the sector before IDX may read pointer blocks, and a
+   pinned sector must not be held while the cache loads
+   another. */
+static block_sector_t
+alloc_hole (struct inode *inode, size_t idx)
+{
+  struct inode_disk *disk_inode = malloc (sizeof *disk_inode);
+  if (disk_inode == NULL)
+    return 0;
+  cache_read (inode->sector, disk_inode);
+  block_sector_t hint = block_hint (disk_inode, inode->sector, idx);
+  free (disk_inode);
+
+  block_sector_t sector;
+  return free_map_allocate_run (hint, 1, &sector) == 1 ? sector : 0;
+}
+
+/* Makes SECTOR hold file sector IDX of INODE, which is a hole,
+   allocating pointer blocks on the way as needed.  Returns false
+   if a pointer block cannot be allocated. */
+static bool
+fill_hole (struct inode *inode, size_t idx, block_sector_t sector)
+{
+  struct inode_disk *disk_inode = malloc (sizeof *disk_inode);
+  if (disk_inode == NULL)
+    return false;
+  cache_read (inode->sector, disk_inode);
+  bool success = set_block (disk_inode, idx, sector);
+  if (success)
+    cache_write (inode->sector, disk_inode);
+  free (disk_inode);
+  return success;
+}
+
+/* Writes SIZE bytes from BUFFER into INODE at OFFSET, all within
+   one sector that was a hole or UNWRITTEN when the caller looked
+   it up.  The rest of the sector is zeroed in the cache rather
+   than on disk, and only then is the sector put into, or marked
+   written in, the block map, so that readers never see what was
+   on disk before.  For the same reason, the journal writes the
+   sector before it commits the change to the block map.  Returns
+   false if a hole could not be filled because the disk is full. */
+static bool
+write_new_sector (struct inode *inode, off_t offset, const void *buffer,
+                  size_t size)
+{
+  static const uint8_t zeros[BLOCK_SECTOR_SIZE];
+  size_t idx = offset / BLOCK_SECTOR_SIZE;
+  size_t sector_ofs = offset % BLOCK_SECTOR_SIZE;
+
+  /* Another writer may have written the sector meanwhile. */
+  journal_begin (inode_credits (BLOCK_SECTOR_SIZE));
+  lock_acquire (&inode->map_lock);
+  block_sector_t sector_idx = byte_to_sector (inode, offset);
+  if (has_data (sector_idx)) {
+    lock_release (&inode->map_lock);
+    journal_end ();
+    write_data (inode, sector_idx, buffer, size, sector_ofs);
+    return true;
+  }
+
+  bool hole = sector_idx == 0;
+  if (hole) {
+    sector_idx = alloc_hole (inode, idx);
+    if (sector_idx == 0) {
+      lock_release (&inode->map_lock);
+      journal_end ();
+      return false;
+    }
+  } else
+    sector_idx &= ~UNWRITTEN;
+
+  if (size < BLOCK_SECTOR_SIZE)
+    write_data (inode, sector_idx, zeros, BLOCK_SECTOR_SIZE, 0);
+  write_data (inode, sector_idx, buffer, size, sector_ofs);
+
+  bool success = true;
+  if (!hole)
+    mark_written (inode, idx, sector_idx);
+  else if (!fill_hole (inode, idx, sector_idx)) {
+    free_map_release (sector_idx, 1);
+    success = false;
+  }
+  if (success && !is_metadata (inode))
+    journal_order (sector_idx);
+  lock_release (&inode->map_lock);
+
+  if (hole)
+    free_map_flush ();
+  journal_end ();
+  return success;
+}
+
+/* Grows INODE to END bytes, allocating sectors for the bytes
+   from OFFSET on, using DISK_INODE as a buffer.  Returns false if
+   the disk is full.  The caller must have locked the range from
+   OFFSET past the end of the file. */
+static bool
+extend (struct inode *inode, struct inode_disk *disk_inode, off_t offset,
+        off_t end)
+{
+  journal_begin (inode_credits (end - offset));
+  lock_acquire (&inode->map_lock);
+  cache_read(inode->sector, disk_inode);
+  bool success = inode_resize(disk_inode, inode->sector, end, offset);
+  if (success) {
+    cache_write(inode->sector, disk_inode);
+    inode->length = disk_inode->length;
+  }
+  lock_release (&inode->map_lock);
+  journal_end ();
+  return success;
+}
+
+/* Sectors freed inside a journal handle can only be reused once
+   the transaction that freed them commits.  If allocating space
+   for a write to INODE failed while such sectors were waiting,
+   commits the transaction and returns true, so that the
+   allocation can be tried again.  Returns false for a directory
+   or the free map, whose writes are themselves inside a handle
+   and so cannot wait for a commit. */
+static bool
+commit_freed_sectors (const struct inode *inode)
+{
+  if (is_metadata (inode) || !free_map_pending (false))
+    return false;
+  journal_commit ();
+  return true;
+}
+
 /* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
    Returns the number of bytes actually written, which may be
    less than SIZE if end of file is reached or an error occurs.
@@ -547,27 +1014,47 @@ inode_write_at (struct inode *inode, const void *buffer_, size_t size,
   const uint8_t *buffer = buffer_;
   off_t bytes_written = 0;
   struct inode_disk *disk_inode = calloc(1, sizeof(struct inode_disk));
-  bool is_extension = false;
+  struct inode_range range;
+  bool denied;
 
-  reader_checkin(inode);
+  if (size >= (size_t) PAST_EOF - offset) {
+    free(disk_inode);
+    return 0;
+  }
 
-  if (inode->deny_write_cnt) {
-    reader_checkout(inode);
+  /* A write to a directory or the free map is one journal
+     transaction, opened before any lock is taken.  A write to a
+     file only journals the changes to its block map, below. */
+  bool metadata = is_metadata (inode);
+  if (metadata)
+    journal_begin (inode_credits (size) + bytes_to_sectors (size) + 1);
+
+  /* Files only grow while open, so a write that ends within the
+     file now cannot become an extension. */
+  off_t end = offset + size;
+  lock_range (inode, &range, offset,
+              end > inode_length (inode) ? PAST_EOF : end, true);
+
+  lock_acquire(&inode->l);
+  denied = inode->deny_write_cnt > 0;
+  lock_release(&inode->l);
+  if (denied) {
+    unlock_range (inode, &range);
+    if (metadata)
+      journal_end ();
     free(disk_inode);
     return 0;
   }
 
-  if (inode_length(inode) < size + offset) {
-      reader_checkout(inode);
-      writer_checkin(inode);
-      is_extension = true;
-      cache_read(inode->sector, disk_inode);
-      if (!inode_resize(disk_inode, size + offset)) {
-        writer_checkout(inode);
-        free(disk_inode);
-        return 0;
-      }
-      cache_write(inode->sector, disk_inode);
+  /* Another writer may have extended the file meanwhile. */
+  if (inode_length(inode) < end
+      && !extend (inode, disk_inode, offset, end)
+      && !(commit_freed_sectors (inode) && extend (inode, disk_inode, offset, end))) {
+    unlock_range (inode, &range);
+    if (metadata)
+      journal_end ();
+    free(disk_inode);
+    return 0;
   }
 
   while (size > 0)
@@ -586,34 +1073,48 @@ inode_write_at (struct inode *inode, const void *buffer_, size_t size,
       if (chunk_size <= 0)
         break;
 
-      
-      cache_write_with_size_and_offset(sector_idx, buffer + bytes_written, chunk_size, sector_ofs);
+      if (!has_data (sector_idx)) {
+        if (!write_new_sector (inode, offset, buffer + bytes_written, chunk_size)
+            && !(commit_freed_sectors (inode)
+                 && write_new_sector (inode, offset, buffer + bytes_written, chunk_size)))
+          break;
+      } else
+        write_data (inode, sector_idx, buffer + bytes_written, chunk_size, sector_ofs);
 
       /* Advance. */
       size -= chunk_size;
       offset += chunk_size;
       bytes_written += chunk_size;
     }
-  
-  if (is_extension) {
-    writer_checkout(inode);
-  } else {
-    reader_checkout(inode);
-  }
 
+  unlock_range (inode, &range);
+  if (metadata)
+    journal_end ();
   free(disk_inode);
   return bytes_written;
 }
 
+/* Makes everything written to INODE durable: writes back its
+   dirty data sectors, leaving other files' alone, then commits
+   the journal transaction that holds its metadata.  Must not be
+   called with a journal handle open. */
+void
+inode_sync (struct inode *inode)
+{
+  if (!is_metadata (inode))
+    cache_write_back_file (inode->sector);
+  journal_commit ();
+}
+
 /* Disables writes to INODE.
    May be called at most once per inode opener. */
 void
 inode_deny_write (struct inode *inode)
 { 
-  writer_checkin(inode);
+  lock_acquire(&inode->l);
   inode->deny_write_cnt++;
   ASSERT (inode->deny_write_cnt <= inode->open_cnt);
-  writer_checkout(inode);
+  lock_release(&inode->l);
 }
 
 /* Re-enables writes to INODE.
@@ -622,33 +1123,90 @@ inode_deny_write (struct inode *inode)
 void
 inode_allow_write (struct inode *inode)
 {
-  writer_checkin(inode);
+  lock_acquire(&inode->l);
   ASSERT (inode->deny_write_cnt > 0);
   ASSERT (inode->deny_write_cnt <= inode->open_cnt);
   inode->deny_write_cnt--;
-  writer_checkout(inode);
+  lock_release(&inode->l);
+}
+
+/* Returns how many of the first CNT entries of pointer block
+   SECTOR are not 0. */
+static size_t
+count_ptrs (block_sector_t sector, size_t cnt)
+{
+  struct cached_sector *cs = cache_acquire (sector, false);
+  const struct indirect *block = cache_read_data (cs);
+  size_t n = 0;
+
+  for (size_t i = 0; i < cnt; i++)
+    if (block->ptrs[i] != 0)
+      n++;
+  cache_release (cs);
+  return n;
+}
+
+/* Stores INODE's length, type and inode number in *ST, all from
+   the in-memory inode, and the number of sectors allocated to it
+   besides the inode itself: data sectors, not counting holes,
+   and pointer blocks.  Counting reads the inode and one sector
+   for each PTRS_PER_SECTOR sectors of the file past the direct
+   pointers, usually from the buffer cache. */
+void
+inode_stat (struct inode *inode, struct stat *st)
+{
+  block_sector_t indirect, doubly_indirect;
+  size_t sectors, cnt = 0;
+
+  lock_acquire (&inode->map_lock);
+  st->length = inode->length;
+  st->isdir = inode->isdir;
+  st->inumber = inode->sector;
+  sectors = bytes_to_sectors (inode->length);
+
+  struct cached_sector *cs = cache_acquire (inode->sector, false);
+  const struct inode_disk *disk_inode = cache_read_data (cs);
+  for (size_t i = 0; i < sectors && i < DIRECT_CNT; i++)
+    if (disk_inode->direct[i] != 0)
+      cnt++;
+  indirect = disk_inode->indirect;
+  doubly_indirect = disk_inode->doubly_indirect;
+  cache_release (cs);
+
+  if (indirect != 0 && sectors > INDIRECT_START)
+    cnt += 1 + count_ptrs (indirect, sectors < DOUBLY_INDIRECT_START
+                                     ? sectors - INDIRECT_START
+                                     : PTRS_PER_SECTOR);
+  if (doubly_indirect != 0 && sectors > DOUBLY_INDIRECT_START)
+    {
+      size_t left = sectors - DOUBLY_INDIRECT_START;
+      cnt++;
+      for (size_t i = 0; left > 0; i++)
+        {
+          size_t n = left < PTRS_PER_SECTOR ? left : PTRS_PER_SECTOR;
+          block_sector_t l1 = read_ptr (doubly_indirect, i);
+          if (l1 != 0)
+            cnt += 1 + count_ptrs (l1, n);
+          left -= n;
+        }
+    }
+  lock_release (&inode->map_lock);
+
+  st->blocks = cnt;
 }
 
 /* Returns the length, in bytes, of INODE's data. */
 off_t
 inode_length (const struct inode *inode)
 {
-  struct inode_disk *disk_inode = calloc(1, sizeof (struct inode_disk));
-  cache_read(inode->sector, disk_inode);
-  size_t result = disk_inode->length;
-  free(disk_inode);
-  return result;
+  return inode->length;
 }
 
 /* Returns true is the inode corresponds to a directory. */
 bool
 is_dir(struct inode *inode)
 {
-  struct inode_disk *disk_inode = calloc(1, sizeof (struct inode_disk));
-  cache_read(inode->sector, disk_inode);
-  bool result = disk_inode->isdir;
-  free(disk_inode);
-  return result;
+  return inode->isdir;
 }
 
 block_sector_t
@@ -656,48 +1214,47 @@ inode_sector(struct inode *inode) {
   return inode->sector;
 }
 
-/* Called when a process wants to read inode data.
- * Required to checkin for the entirety of inode_read_at call
- * Required to checkin for inode_write_at loop if not an extension. */
-void reader_checkin(struct inode *inode) {
-  lock_acquire(&(inode->l));
-  while (inode->active_writers + inode->waiting_writers > 0) {
-    inode->waiting_readers++;
-    cond_wait(&(inode->ok_to_read), &(inode->l));
-    inode->waiting_readers--;
-  }
-  inode->active_readers++;
-  lock_release(&(inode->l));
-};
+/* Returns true if R overlaps a range already locked on INODE
+   in a way that excludes it.  Caller must hold INODE's lock. */
+static bool
+range_conflicts (struct inode *inode, const struct inode_range *r)
+{
+  struct list_elem *e;
 
-void reader_checkout(struct inode *inode) {
-  lock_acquire(&(inode->l));
-  inode->active_readers--;
-  if (inode->active_readers == 0 && inode->waiting_writers > 0) {
-    cond_signal(&(inode->ok_to_write), &(inode->l));
-  }
-  lock_release(&(inode->l));
-};
+  for (e = list_begin (&inode->ranges); e != list_end (&inode->ranges);
+       e = list_next (e))
+    {
+      struct inode_range *held = list_entry (e, struct inode_range, elem);
+      if ((r->exclusive || held->exclusive)
+          && r->start < held->end && held->start < r->end)
+        return true;
+    }
+  return false;
+}
 
-/* Called when process wants to edit inode data or extend the file. */
-void writer_checkin(struct inode *inode) {
-  lock_acquire(&(inode->l));
-  while (inode->active_writers + inode->active_readers > 0) {
-    inode->waiting_writers++;
-    cond_wait(&(inode->ok_to_write), &(inode->l));
-    inode->waiting_writers--;
-  }
-  inode->active_writers++;
-  lock_release(&(inode->l));
-};
+/* Locks the bytes of INODE from START up to END, waiting for any
+   conflicting range to be unlocked, and records the lock in R. */
+static void
+lock_range (struct inode *inode, struct inode_range *r, off_t start,
+            off_t end, bool exclusive)
+{
+  r->start = start;
+  r->end = end;
+  r->exclusive = exclusive;
+
+  lock_acquire (&inode->l);
+  while (range_conflicts (inode, r))
+    cond_wait (&inode->range_released, &inode->l);
+  list_push_back (&inode->ranges, &r->elem);
+  lock_release (&inode->l);
+}
 
-void writer_checkout(struct inode *inode) {
-  lock_acquire(&(inode->l));
-  inode->active_writers--;
-  if (inode->waiting_writers > 0) {
-    cond_signal(&(inode->ok_to_write), &(inode->l));
-  } else if (inode->waiting_readers > 0) {
-    cond_broadcast(&(inode->ok_to_read), &(inode->l));
-  }
-  lock_release(&(inode->l));
-};
\ No newline at end of file
+/* Unlocks range R of INODE. */
+static void
+unlock_range (struct inode *inode, struct inode_range *r)
+{
+  lock_acquire (&inode->l);
+  list_remove (&r->elem);
+  cond_broadcast (&inode->range_released, &inode->l);
+  lock_release (&inode->l);
+}
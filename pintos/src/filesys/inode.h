@@ -4,30 +4,51 @@
 #include <stdbool.h>
 #include "filesys/off_t.h"
 #include "devices/block.h"
+#include <hash.h>
 #include <list.h>
 #include "threads/synch.h"
 
 struct bitmap;
+struct cached_sector;
+struct stat;
 
 /* In-memory inode. */
 struct inode {
-    struct list_elem elem;              /* Element in inode list. */
-    struct lock l; 			                /* Acquire while changing inode  */
+    struct hash_elem elem;              /* Element in open inode table. */
+    struct lock l;                      /* Protects open_cnt, pin_cnt,
+                                           removed, deny_write_cnt and
+                                           ranges. */
     struct lock dir_lock;
+    struct lock map_lock;               /* Held while changing the block
+                                           map or length. */
     block_sector_t sector;              /* Sector number of disk location. */
     int open_cnt;                       /* Number of openers. */
+    int pin_cnt;                        /* Queued read-ahead requests.
+                                           They keep the inode in memory
+                                           but are not openers. */
     bool removed;                       /* True if deleted, false otherwise. */
     int deny_write_cnt;                 /* 0: writes ok, >0: deny writes. */
 
-    size_t active_writers;
-    size_t active_readers;
-    size_t waiting_writers;
-    size_t waiting_readers;
-    struct condition ok_to_read;
-    struct condition ok_to_write;
+    /* Copies of fields of the on-disk inode, kept while the inode is
+       open.  Changed only while holding map_lock, and written back to
+       the inode's sector at the same time. */
+    off_t length;                       /* File size in bytes. */
+    bool isdir;                         /* True if a directory. */
+
+    struct list ranges;                 /* Byte ranges locked by reads
+                                           and writes in progress. */
+    struct condition range_released;    /* Signaled when a range is
+                                           unlocked. */
+
+    /* Read-ahead state.  Updated by concurrent readers without
+       locking; a lost update only costs a missed prefetch. */
+    off_t ra_next;                      /* Offset a sequential read starts at. */
+    off_t ra_end;                       /* End of range already prefetched. */
+    size_t ra_window;                   /* Sectors to keep prefetched. */
 };
 
 void inode_init (void);
+size_t inode_credits (off_t);
 bool inode_create (block_sector_t, off_t);
 bool inode_create_dir (block_sector_t, off_t);
 struct inode *inode_open (block_sector_t);
@@ -36,10 +57,13 @@ block_sector_t inode_get_inumber (const struct inode *);
 void inode_close (struct inode *);
 void inode_remove (struct inode *);
 off_t inode_read_at (struct inode *, void *, size_t size, size_t offset);
+struct cached_sector *inode_acquire_sector (struct inode *, off_t offset);
 off_t inode_write_at (struct inode *, const void *, size_t size, size_t offset);
+void inode_sync (struct inode *);
 void inode_deny_write (struct inode *);
 void inode_allow_write (struct inode *);
 off_t inode_length (const struct inode *);
+void inode_stat (struct inode *, struct stat *);
 bool is_dir(struct inode *);
 block_sector_t inode_sector(struct inode *);
 
@@ -0,0 +1,532 @@
+#include "filesys/journal.h"
+#include <debug.h>
+#include <hash.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "filesys/cache.h"
+#include "filesys/filesys.h"
+#include "filesys/free-map.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+
+/* Write-ahead journal for file system metadata.
+
+   Every change to an inode, a pointer block, a directory or the
+   free map is made inside a handle, opened by journal_begin() and
+   closed by journal_end().  While a handle is open, the buffer
+   cache copies each metadata sector it changes into the running
+   transaction, and does not write that sector home.  Handles of
+   many threads join the same transaction, which is committed
+   once it has been open for cache_flush_age ticks, once it is
+   half full, or on request, whichever comes first.
+
+   To commit, the data sectors the transaction points to for the
+   first time are written, then the transaction is written to the
+   journal: descriptors listing the sectors, their images, and a
+   commit record with a checksum of the images.  Only then are
+   the images written home.  Each commit rewrites the journal from
+   its start, so the journal holds at most one transaction, and
+   recovery after a crash replays just that one: it takes time in
+   proportion to the journal, not to the size of the disk. */
+
+#define DESC_MAGIC 0x4a444553           /* "JDES" */
+#define COMMIT_MAGIC 0x4a434d54         /* "JCMT" */
+
+/* Journal descriptor.  Descriptors come first in the journal and
+   list the home sectors of the images that follow them, in
+   order.  Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+struct journal_desc {
+  uint32_t magic;                       /* DESC_MAGIC. */
+  uint32_t seq;                         /* Transaction sequence number. */
+  uint32_t cnt;                         /* Images in the transaction. */
+  block_sector_t sectors[JOURNAL_DESC_ENTRIES];
+};
+
+/* Commit record, written after the images.  A transaction whose
+   commit record does not match its descriptor and images was
+   interrupted and is not replayed. */
+struct journal_commit {
+  uint32_t magic;                       /* COMMIT_MAGIC. */
+  uint32_t seq;                         /* Transaction sequence number. */
+  uint32_t cnt;                         /* Images in the transaction. */
+  uint32_t checksum;                    /* Of the images, in order. */
+  uint8_t unused[BLOCK_SECTOR_SIZE - 4 * sizeof (uint32_t)];
+};
+
+/* A sector changed by the running transaction. */
+struct journal_image {
+  struct hash_elem elem;                /* Element in image_index. */
+  block_sector_t sector;                /* Home sector. */
+  bool revoked;                         /* Sector freed; not written. */
+  uint8_t *data;                        /* Latest contents. */
+};
+
+/* Data sectors whose addresses first appear in the running
+   transaction.  They are written before it commits, so that a
+   replayed pointer never leads to stale data.  Once the list is
+   full, further sectors are written back as they are added. */
+#define ORDERED_MAX 64
+
+/* Where the transaction stands.  All protected by journal_lock. */
+static struct lock journal_lock;
+static struct condition journal_changed;  /* Signaled when a commit ends
+                                             or the last handle closes. */
+static struct journal_image *images;    /* image_cnt in use. */
+static size_t image_cnt;
+static struct hash image_index;         /* Maps sector to image. */
+static block_sector_t ordered[ORDERED_MAX];
+static size_t ordered_cnt;
+static size_t handle_cnt;               /* Outermost handles open. */
+static size_t reserved;                 /* Credits of the open handles. */
+static size_t room;                     /* Images a transaction may hold. */
+static int64_t txn_start;               /* When the first image was logged. */
+static bool committing;                 /* A commit is being written. */
+static bool commit_wanted;              /* Commit once the handles close. */
+static uint32_t seq;                    /* Sequence number of the
+                                           running transaction. */
+
+/* Buffers for journal sectors, used only by the committing
+   thread or during initialization. */
+static struct journal_desc desc;
+static struct journal_commit commit_rec;
+
+/* Statistics. */
+static unsigned long long commit_cnt;   /* Transactions committed. */
+static unsigned long long logged_cnt;   /* Images written to the journal. */
+
+static hash_hash_func image_hash;
+static hash_less_func image_less;
+static void replay (void);
+static void commit (void);
+
+static void write_empty (void);
+
+/* Initializes the journal.  If FORMAT is true, starts an empty
+   journal; otherwise replays the last transaction if it
+   committed.  Must be called after free_map_init() and before
+   anything else reads or writes the file system. */
+void
+journal_init (bool format)
+{
+  size_t pages = DIV_ROUND_UP (JOURNAL_MAX_IMAGES * BLOCK_SECTOR_SIZE, PGSIZE);
+  uint8_t *data = palloc_get_multiple (0, pages);
+  images = palloc_get_multiple (0, DIV_ROUND_UP (JOURNAL_MAX_IMAGES * sizeof *images,
+                                                 PGSIZE));
+  if (data == NULL || images == NULL)
+    PANIC ("journal: can't allocate transaction buffer");
+  for (size_t i = 0; i < JOURNAL_MAX_IMAGES; i++)
+    images[i].data = data + i * BLOCK_SECTOR_SIZE;
+  hash_init (&image_index, image_hash, image_less, NULL);
+
+  lock_init (&journal_lock);
+  cond_init (&journal_changed);
+  image_cnt = ordered_cnt = handle_cnt = reserved = 0;
+  committing = commit_wanted = false;
+
+  /* Any transaction may change every sector of the free map, by
+     allocating in its handles or by the deferred frees applied as
+     it commits, so room for all of them is set aside and handles
+     need not reserve it. */
+  room = JOURNAL_MAX_IMAGES - free_map_file_sectors ();
+
+  seq = 1;
+  if (!format)
+    replay ();
+  write_empty ();
+}
+
+/* Commits the running transaction and marks the journal empty,
+   so that the next boot has nothing to replay.  Called at
+   shutdown, once nothing else will change the file system. */
+void
+journal_done (void)
+{
+  journal_commit ();
+  write_empty ();
+}
+
+/* Writes an empty descriptor, which marks the journal as holding
+   nothing to replay, and starts a new sequence number. */
+static void
+write_empty (void)
+{
+  memset (&desc, 0, sizeof desc);
+  desc.magic = DESC_MAGIC;
+  desc.seq = seq++;
+  block_write (fs_device, JOURNAL_SECTOR, &desc);
+}
+
+/* Returns checksum SUM of the images before the one at DATA,
+   extended to cover that one too. */
+static uint32_t
+checksum_add (uint32_t sum, const void *data)
+{
+  return sum * 31 + hash_bytes (data, BLOCK_SECTOR_SIZE);
+}
+
+/* Replays the transaction in the journal, if its commit record
+   made it to disk. */
+static void
+replay (void)
+{
+  static uint8_t buf[BLOCK_SECTOR_SIZE];
+  block_read (fs_device, JOURNAL_SECTOR, &desc);
+  if (desc.magic != DESC_MAGIC)
+    return;
+  seq = desc.seq + 1;
+
+  size_t cnt = desc.cnt;
+  size_t desc_cnt = DIV_ROUND_UP (cnt, JOURNAL_DESC_ENTRIES);
+  if (cnt == 0 || cnt > JOURNAL_MAX_IMAGES)
+    return;
+
+  /* Check the commit record against the images. */
+  block_read (fs_device, JOURNAL_SECTOR + desc_cnt + cnt, &commit_rec);
+  if (commit_rec.magic != COMMIT_MAGIC || commit_rec.seq != desc.seq
+      || commit_rec.cnt != cnt)
+    return;
+  uint32_t sum = 0;
+  for (size_t i = 0; i < cnt; i++) {
+    block_read (fs_device, JOURNAL_SECTOR + desc_cnt + i, buf);
+    sum = checksum_add (sum, buf);
+  }
+  if (sum != commit_rec.checksum)
+    return;
+
+  /* Write each image home, reading the descriptor that lists it
+     when it is reached. */
+  uint32_t txn_seq = desc.seq;
+  for (size_t i = 0; i < cnt; i++) {
+    if (i % JOURNAL_DESC_ENTRIES == 0) {
+      block_read (fs_device, JOURNAL_SECTOR + i / JOURNAL_DESC_ENTRIES, &desc);
+      if (desc.magic != DESC_MAGIC || desc.seq != txn_seq)
+        PANIC ("journal: descriptor %zu of committed transaction is bad",
+               i / JOURNAL_DESC_ENTRIES);
+    }
+    block_read (fs_device, JOURNAL_SECTOR + desc_cnt + i, buf);
+    block_write (fs_device, desc.sectors[i % JOURNAL_DESC_ENTRIES], buf);
+  }
+  printf ("journal: replayed %zu sectors\n", cnt);
+}
+
+/* Returns the image of SECTOR in the running transaction, or a
+   null pointer if there is none.  Caller must hold
+   journal_lock. */
+static struct journal_image *
+find_image (block_sector_t sector)
+{
+  struct journal_image key;
+  struct hash_elem *e;
+
+  key.sector = sector;
+  e = hash_find (&image_index, &key.elem);
+  return e != NULL ? hash_entry (e, struct journal_image, elem) : NULL;
+}
+
+/* Returns true if the running transaction should be committed
+   as soon as its handles close.  Caller must hold
+   journal_lock. */
+static bool
+commit_due (void)
+{
+  return (commit_wanted
+          || image_cnt >= room / 2
+          || (image_cnt > 0 && timer_elapsed (txn_start) >= cache_flush_age));
+}
+
+/* Opens a handle, in which the current thread may change up to
+   CREDITS metadata sectors, all of which will reach the disk
+   together or not at all.  Handles nest: an inner handle joins
+   the outer one, and its CREDITS must be part of the outer
+   handle's.  The outermost handle may wait for a commit, so it
+   must not be opened while holding any file system lock.  It
+   waits for one if the transaction is too full to hold CREDITS
+   more sectors, or if the disk is nearly full and the
+   transaction has freed sectors that its commit would make
+   available. */
+void
+journal_begin (size_t credits)
+{
+  struct thread *t = thread_current ();
+  if (t->journal_depth++ > 0)
+    return;
+
+  /* free_map_lock is taken before journal_lock elsewhere, so ask
+     about free space first. */
+  bool low_space = free_map_pending (true);
+
+  lock_acquire (&journal_lock);
+  if (credits > room)
+    credits = room;
+  for (;;) {
+    bool full = image_cnt + reserved + credits > room || low_space;
+    if (committing)
+      cond_wait (&journal_changed, &journal_lock);
+    else if (full || commit_wanted) {
+      low_space = false;
+      if (handle_cnt == 0)
+        commit ();
+      else {
+        commit_wanted = true;
+        cond_wait (&journal_changed, &journal_lock);
+      }
+    } else
+      break;
+  }
+  handle_cnt++;
+  reserved += credits;
+  t->journal_credits = credits;
+  lock_release (&journal_lock);
+}
+
+/* Closes the current thread's innermost handle.  Closing the
+   last handle open in the running transaction commits it if it
+   is due. */
+void
+journal_end (void)
+{
+  struct thread *t = thread_current ();
+  ASSERT (t->journal_depth > 0);
+  if (--t->journal_depth > 0)
+    return;
+
+  lock_acquire (&journal_lock);
+  reserved -= t->journal_credits;
+  if (--handle_cnt == 0) {
+    if (commit_due ())
+      commit ();
+    else
+      cond_broadcast (&journal_changed, &journal_lock);
+  }
+  lock_release (&journal_lock);
+}
+
+/* Returns true if the current thread has a handle open, so that
+   the metadata it changes belongs in the running transaction. */
+bool
+journal_active (void)
+{
+  return thread_current ()->journal_depth > 0;
+}
+
+/* Records DATA as the new contents of metadata SECTOR in the
+   running transaction.  Called by the buffer cache, with SECTOR
+   locked, each time a handle changes it. */
+void
+journal_log (block_sector_t sector, const void *data)
+{
+  lock_acquire (&journal_lock);
+  struct journal_image *img = find_image (sector);
+  if (img == NULL) {
+    if (image_cnt == JOURNAL_MAX_IMAGES)
+      PANIC ("journal: transaction changed more than %d sectors",
+             JOURNAL_MAX_IMAGES);
+    if (image_cnt == 0)
+      txn_start = timer_ticks ();
+    img = &images[image_cnt++];
+    img->sector = sector;
+    img->revoked = false;
+    hash_insert (&image_index, &img->elem);
+  }
+  memcpy (img->data, data, BLOCK_SECTOR_SIZE);
+  lock_release (&journal_lock);
+}
+
+/* Notes that SECTOR has been freed in the running transaction.
+   If it was changed in the transaction, its image is neither
+   written to the journal nor home, since after the commit nothing
+   points to it, and before the commit its old contents must stay
+   on disk. */
+void
+journal_revoke (block_sector_t sector)
+{
+  lock_acquire (&journal_lock);
+  struct journal_image *img = find_image (sector);
+  if (img != NULL)
+    img->revoked = true;
+  lock_release (&journal_lock);
+}
+
+/* Notes that data SECTOR, written through the cache, is pointed
+   to for the first time by the running transaction. */
+void
+journal_order (block_sector_t sector)
+{
+  lock_acquire (&journal_lock);
+  bool listed = ordered_cnt < ORDERED_MAX;
+  if (listed)
+    ordered[ordered_cnt++] = sector;
+  lock_release (&journal_lock);
+
+  if (!listed)
+    cache_write_back (sector);
+}
+
+/* Returns true if SECTOR has been changed by the running
+   transaction, in which case its cached copy must not be written
+   home until the transaction commits. */
+bool
+journal_holds (block_sector_t sector)
+{
+  lock_acquire (&journal_lock);
+  bool held = image_cnt > 0 && find_image (sector) != NULL;
+  lock_release (&journal_lock);
+  return held;
+}
+
+/* If SECTOR has been changed by the running transaction, copies
+   its latest contents into BUF and returns true.  Used by the
+   cache to reload a sector it evicted without writing back. */
+bool
+journal_lookup (block_sector_t sector, void *buf)
+{
+  lock_acquire (&journal_lock);
+  struct journal_image *img = image_cnt > 0 ? find_image (sector) : NULL;
+  if (img != NULL)
+    memcpy (buf, img->data, BLOCK_SECTOR_SIZE);
+  lock_release (&journal_lock);
+  return img != NULL;
+}
+
+/* Commits the running transaction once every handle in it has
+   closed, and returns once it is on disk.  Must not be called
+   with a handle open. */
+void
+journal_commit (void)
+{
+  ASSERT (!journal_active ());
+
+  lock_acquire (&journal_lock);
+  commit_wanted = true;
+  while (committing || handle_cnt > 0)
+    cond_wait (&journal_changed, &journal_lock);
+  commit ();
+  lock_release (&journal_lock);
+}
+
+/* Commits the running transaction if it has been open for AGE
+   ticks and no handle is open in it.  Called periodically by the
+   cache flusher, so that a quiet file system still commits. */
+void
+journal_commit_old (int64_t age)
+{
+  lock_acquire (&journal_lock);
+  if (!committing && handle_cnt == 0 && image_cnt > 0
+      && timer_elapsed (txn_start) >= age)
+    commit ();
+  lock_release (&journal_lock);
+}
+
+/* Prints journal statistics. */
+void
+journal_print_stats (void)
+{
+  printf ("Journal: %llu transactions committed, %llu sectors logged\n",
+          commit_cnt, logged_cnt);
+}
+
+/* Writes the images that were not revoked to the journal, with
+   their descriptors and commit record, and returns how many were
+   written. */
+static size_t
+write_log (void)
+{
+  size_t cnt = 0;
+  for (size_t i = 0; i < image_cnt; i++)
+    if (!images[i].revoked)
+      cnt++;
+  if (cnt == 0)
+    return 0;
+
+  size_t desc_cnt = DIV_ROUND_UP (cnt, JOURNAL_DESC_ENTRIES);
+  uint32_t sum = 0;
+  size_t j = 0;
+  memset (&desc, 0, sizeof desc);
+  desc.magic = DESC_MAGIC;
+  desc.seq = seq;
+  desc.cnt = cnt;
+  for (size_t i = 0; i < image_cnt; i++) {
+    struct journal_image *img = &images[i];
+    if (img->revoked)
+      continue;
+    desc.sectors[j % JOURNAL_DESC_ENTRIES] = img->sector;
+    block_write (fs_device, JOURNAL_SECTOR + desc_cnt + j, img->data);
+    sum = checksum_add (sum, img->data);
+    if (++j % JOURNAL_DESC_ENTRIES == 0 || j == cnt) {
+      block_write (fs_device, JOURNAL_SECTOR + (j - 1) / JOURNAL_DESC_ENTRIES, &desc);
+      memset (desc.sectors, 0, sizeof desc.sectors);
+    }
+  }
+
+  memset (&commit_rec, 0, sizeof commit_rec);
+  commit_rec.magic = COMMIT_MAGIC;
+  commit_rec.seq = seq;
+  commit_rec.cnt = cnt;
+  commit_rec.checksum = sum;
+  block_write (fs_device, JOURNAL_SECTOR + desc_cnt + cnt, &commit_rec);
+  return cnt;
+}
+
+/* Commits the running transaction.  No handles may be open.
+   Caller must hold journal_lock, which is released while the
+   transaction is written and held again on return. */
+static void
+commit (void)
+{
+  struct thread *t = thread_current ();
+
+  ASSERT (handle_cnt == 0 && !committing);
+  committing = true;
+  commit_wanted = false;
+  lock_release (&journal_lock);
+
+  for (size_t i = 0; i < ordered_cnt; i++)
+    cache_write_back (ordered[i]);
+
+  /* Sectors freed in the transaction were kept in use until now,
+     so that nothing could overwrite them before the frees were
+     committed.  Release them, as part of this transaction. */
+  t->journal_depth++;
+  free_map_release_pending ();
+  t->journal_depth--;
+
+  /* No handle can change an image while committing is set, so
+     they can be read without the lock. */
+  size_t cnt = write_log ();
+  for (size_t i = 0; i < image_cnt; i++) {
+    struct journal_image *img = &images[i];
+    if (!img->revoked)
+      block_write (fs_device, img->sector, img->data);
+    cache_clean (img->sector);
+  }
+
+  lock_acquire (&journal_lock);
+  hash_clear (&image_index, NULL);
+  image_cnt = ordered_cnt = 0;
+  if (cnt > 0) {
+    seq++;
+    commit_cnt++;
+    logged_cnt += cnt;
+  }
+  committing = false;
+  cond_broadcast (&journal_changed, &journal_lock);
+}
+
+/* Returns a hash value for the image containing E. */
+static unsigned
+image_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  return hash_int (hash_entry (e, struct journal_image, elem)->sector);
+}
+
+/* Returns true if image A precedes image B. */
+static bool
+image_less (const struct hash_elem *a, const struct hash_elem *b,
+            void *aux UNUSED)
+{
+  return (hash_entry (a, struct journal_image, elem)->sector
+          < hash_entry (b, struct journal_image, elem)->sector);
+}
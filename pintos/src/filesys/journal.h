@@ -0,0 +1,37 @@
+#ifndef FILESYS_JOURNAL_H
+#define FILESYS_JOURNAL_H
+
+#include <round.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "devices/block.h"
+
+/* Most metadata sectors one transaction can change. */
+#define JOURNAL_MAX_IMAGES 250
+
+/* Sector entries in one journal descriptor sector. */
+#define JOURNAL_DESC_ENTRIES ((BLOCK_SECTOR_SIZE - 3 * sizeof (uint32_t)) \
+                              / sizeof (block_sector_t))
+
+/* Sectors reserved for the journal, starting at JOURNAL_SECTOR:
+   descriptors, one image of each sector a transaction changes,
+   and a commit record. */
+#define JOURNAL_SECTORS (DIV_ROUND_UP (JOURNAL_MAX_IMAGES, JOURNAL_DESC_ENTRIES) \
+                         + JOURNAL_MAX_IMAGES + 1)
+
+void journal_init (bool format);
+void journal_done (void);
+void journal_begin (size_t credits);
+void journal_end (void);
+bool journal_active (void);
+void journal_log (block_sector_t, const void *);
+void journal_revoke (block_sector_t);
+void journal_order (block_sector_t);
+bool journal_holds (block_sector_t);
+bool journal_lookup (block_sector_t, void *);
+void journal_commit (void);
+void journal_commit_old (int64_t age);
+void journal_print_stats (void);
+
+#endif /* filesys/journal.h */
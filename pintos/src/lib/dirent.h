@@ -0,0 +1,17 @@
+#ifndef __LIB_DIRENT_H
+#define __LIB_DIRENT_H
+
+#include <stdbool.h>
+
+/* Longest file name in a directory entry. */
+#define DIRENT_NAME_MAX 14
+
+/* A directory entry, as stored by the getdents() system call. */
+struct dirent
+  {
+    int inumber;                        /* Inode number of the file. */
+    bool isdir;                         /* True if it is a directory. */
+    char name[DIRENT_NAME_MAX + 1];     /* Null terminated file name. */
+  };
+
+#endif /* lib/dirent.h */
@@ -60,6 +60,29 @@ byte_cnt (size_t bit_cnt)
   return sizeof (elem_type) * elem_cnt (bit_cnt);
 }
 
+/* Returns an elem_type in which bits LO through HI - 1 are set
+   and the rest are clear.  Requires LO < HI <= ELEM_BITS. */
+static inline elem_type
+range_mask (size_t lo, size_t hi)
+{
+  elem_type high = hi < ELEM_BITS ? ((elem_type) 1 << hi) - 1 : (elem_type) -1;
+  return high & ~(((elem_type) 1 << lo) - 1);
+}
+
+/* Returns the number of set bits in X. */
+static inline size_t
+popcount (elem_type x)
+{
+  /* Add adjacent bits, then pairs, then nibbles, then let the
+     multiply sum the bytes into the top byte.  The kernel is not
+     linked with libgcc, so __builtin_popcountl() is unavailable. */
+  const elem_type ones = (elem_type) -1;
+  x = x - ((x >> 1) & (ones / 3));
+  x = (x & (ones / 5)) + ((x >> 2) & (ones / 5));
+  x = (x + (x >> 4)) & (ones / 17);
+  return (elem_type) (x * (ones / 255)) >> (ELEM_BITS - CHAR_BIT);
+}
+
 /* Returns a bit mask in which the bits actually used in the last
    element of B's bits are set to 1 and the rest are set to 0. */
 static inline elem_type
@@ -152,32 +175,42 @@ bitmap_set (struct bitmap *b, size_t idx, bool value)
     bitmap_reset (b, idx);
 }
 
-/* Atomically sets the bit numbered BIT_IDX in B to true. */
-void
-bitmap_mark (struct bitmap *b, size_t bit_idx)
+/* Atomically sets the bits in MASK of element IDX of B to
+   true. */
+static inline void
+mark_elem (struct bitmap *b, size_t idx, elem_type mask)
 {
-  size_t idx = elem_idx (bit_idx);
-  elem_type mask = bit_mask (bit_idx);
-
   /* This is equivalent to `b->bits[idx] |= mask' except that it
      is guaranteed to be atomic on a uniprocessor machine.  See
      the description of the OR instruction in [IA32-v2b]. */
   asm ("orl %1, %0" : "=m" (b->bits[idx]) : "r" (mask) : "cc");
 }
 
-/* Atomically sets the bit numbered BIT_IDX in B to false. */
-void
-bitmap_reset (struct bitmap *b, size_t bit_idx)
+/* Atomically sets the bits in MASK of element IDX of B to
+   false. */
+static inline void
+reset_elem (struct bitmap *b, size_t idx, elem_type mask)
 {
-  size_t idx = elem_idx (bit_idx);
-  elem_type mask = bit_mask (bit_idx);
-
   /* This is equivalent to `b->bits[idx] &= ~mask' except that it
      is guaranteed to be atomic on a uniprocessor machine.  See
      the description of the AND instruction in [IA32-v2a]. */
   asm ("andl %1, %0" : "=m" (b->bits[idx]) : "r" (~mask) : "cc");
 }
 
+/* Atomically sets the bit numbered BIT_IDX in B to true. */
+void
+bitmap_mark (struct bitmap *b, size_t bit_idx)
+{
+  mark_elem (b, elem_idx (bit_idx), bit_mask (bit_idx));
+}
+
+/* Atomically sets the bit numbered BIT_IDX in B to false. */
+void
+bitmap_reset (struct bitmap *b, size_t bit_idx)
+{
+  reset_elem (b, elem_idx (bit_idx), bit_mask (bit_idx));
+}
+
 /* Atomically toggles the bit numbered IDX in B;
    that is, if it is true, makes it false,
    and if it is false, makes it true. */
@@ -213,18 +246,54 @@ bitmap_set_all (struct bitmap *b, bool value)
   bitmap_set_multiple (b, 0, bitmap_size (b), value);
 }
 
-/* Sets the CNT bits starting at START in B to VALUE. */
+/* Sets the CNT bits starting at START in B to VALUE.
+   Each element is set atomically, but the elements are not all
+   set at once. */
 void
 bitmap_set_multiple (struct bitmap *b, size_t start, size_t cnt, bool value)
 {
-  size_t i;
+  size_t end = start + cnt;
 
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
   ASSERT (start + cnt <= b->bit_cnt);
 
-  for (i = 0; i < cnt; i++)
-    bitmap_set (b, start + i, value);
+  while (start < end)
+    {
+      size_t idx = elem_idx (start);
+      size_t lo = start % ELEM_BITS;
+      size_t hi = end - start < ELEM_BITS - lo ? lo + (end - start) : ELEM_BITS;
+      elem_type mask = range_mask (lo, hi);
+
+      if (value)
+        mark_elem (b, idx, mask);
+      else
+        reset_elem (b, idx, mask);
+      start += hi - lo;
+    }
+}
+
+/* Returns the index of the first bit in B between START and END,
+   exclusive, that is set to VALUE, or END if there is none.
+   Whole elements are skipped at a time. */
+static size_t
+find_bit (const struct bitmap *b, size_t start, size_t end, bool value)
+{
+  while (start < end)
+    {
+      size_t idx = elem_idx (start);
+      size_t lo = start % ELEM_BITS;
+      elem_type bits = b->bits[idx] ^ (value ? 0 : (elem_type) -1);
+
+      bits &= ~(((elem_type) 1 << lo) - 1);
+      if (bits != 0)
+        {
+          size_t bit_idx = idx * ELEM_BITS + __builtin_ctzl (bits);
+          return bit_idx < end ? bit_idx : end;
+        }
+      start = (idx + 1) * ELEM_BITS;
+    }
+  return end;
 }
 
 /* Returns the number of bits in B between START and START + CNT,
@@ -232,17 +301,23 @@ bitmap_set_multiple (struct bitmap *b, size_t start, size_t cnt, bool value)
 size_t
 bitmap_count (const struct bitmap *b, size_t start, size_t cnt, bool value)
 {
-  size_t i, value_cnt;
+  size_t end = start + cnt;
+  size_t true_cnt = 0;
 
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
   ASSERT (start + cnt <= b->bit_cnt);
 
-  value_cnt = 0;
-  for (i = 0; i < cnt; i++)
-    if (bitmap_test (b, start + i) == value)
-      value_cnt++;
-  return value_cnt;
+  while (start < end)
+    {
+      size_t idx = elem_idx (start);
+      size_t lo = start % ELEM_BITS;
+      size_t hi = end - start < ELEM_BITS - lo ? lo + (end - start) : ELEM_BITS;
+
+      true_cnt += popcount (b->bits[idx] & range_mask (lo, hi));
+      start += hi - lo;
+    }
+  return value ? true_cnt : cnt - true_cnt;
 }
 
 /* Returns true if any bits in B between START and START + CNT,
@@ -250,16 +325,11 @@ bitmap_count (const struct bitmap *b, size_t start, size_t cnt, bool value)
 bool
 bitmap_contains (const struct bitmap *b, size_t start, size_t cnt, bool value)
 {
-  size_t i;
-
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
   ASSERT (start + cnt <= b->bit_cnt);
 
-  for (i = 0; i < cnt; i++)
-    if (bitmap_test (b, start + i) == value)
-      return true;
-  return false;
+  return find_bit (b, start, start + cnt, value) < start + cnt;
 }
 
 /* Returns true if any bits in B between START and START + CNT,
@@ -296,15 +366,38 @@ size_t
 bitmap_scan (const struct bitmap *b, size_t start, size_t cnt, bool value)
 {
   ASSERT (b != NULL);
-  ASSERT (start <= b->bit_cnt);
+  return bitmap_scan_range (b, start, b->bit_cnt, cnt, value);
+}
+
+/* Finds and returns the starting index of the first group of CNT
+   consecutive bits in B that are all set to VALUE and lie between
+   START and END, exclusive.
+   If there is no such group, returns BITMAP_ERROR. */
+size_t
+bitmap_scan_range (const struct bitmap *b, size_t start, size_t end,
+                   size_t cnt, bool value)
+{
+  ASSERT (b != NULL);
+  ASSERT (start <= end);
+  ASSERT (end <= b->bit_cnt);
 
-  if (cnt <= b->bit_cnt)
+  if (cnt == 0)
+    return start;
+
+  /* Find a bit set to VALUE, then look for a bit set to !VALUE
+     among the CNT bits that begin there.  If there is one, no
+     group can begin before it, so continue from the bit after
+     it. */
+  while (end - start >= cnt)
     {
-      size_t last = b->bit_cnt - cnt;
-      size_t i;
-      for (i = start; i <= last; i++)
-        if (!bitmap_contains (b, i, cnt, !value))
-          return i;
+      size_t i = find_bit (b, start, end, value);
+      if (end - i < cnt)
+        break;
+
+      size_t j = find_bit (b, i, i + cnt, !value);
+      if (j == i + cnt)
+        return i;
+      start = j + 1;
     }
   return BITMAP_ERROR;
 }
@@ -358,6 +451,20 @@ bitmap_write (const struct bitmap *b, struct file *file)
   off_t size = byte_cnt (b->bit_cnt);
   return file_write_at (file, b->bits, size, 0) == size;
 }
+
+/* Writes the SIZE bytes of B's file image that start at byte OFS
+   to the same place in FILE, stopping at the end of B.  Return
+   true if successful, false otherwise. */
+bool
+bitmap_write_part (const struct bitmap *b, struct file *file,
+                   off_t ofs, off_t size)
+{
+  off_t total = byte_cnt (b->bit_cnt);
+  ASSERT (ofs <= total);
+  if (size > total - ofs)
+    size = total - ofs;
+  return file_write_at (file, (const char *) b->bits + ofs, size, ofs) == size;
+}
 #endif /* FILESYS */
 
 /* Debugging. */
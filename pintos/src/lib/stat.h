@@ -0,0 +1,16 @@
+#ifndef __LIB_STAT_H
+#define __LIB_STAT_H
+
+#include <stdbool.h>
+
+/* Information about a file, as stored by the stat() and fstat()
+   system calls. */
+struct stat
+  {
+    int length;                         /* File size in bytes. */
+    bool isdir;                         /* True if it is a directory. */
+    int inumber;                        /* Inode number of the file. */
+    int blocks;                         /* Sectors allocated to it. */
+  };
+
+#endif /* lib/stat.h */
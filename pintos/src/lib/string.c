@@ -1,5 +1,6 @@
 #include <string.h>
 #include <debug.h>
+#include <stdint.h>
 
 /* Copies SIZE bytes from SRC to DST, which must not overlap.
    Returns DST. */
@@ -12,6 +13,23 @@ memcpy (void *dst_, const void *src_, size_t size)
   ASSERT (dst != NULL || size == 0);
   ASSERT (src != NULL || size == 0);
 
+  /* If DST and SRC can be aligned together, copy a word at a
+     time once they are. */
+  if (((uintptr_t) dst ^ (uintptr_t) src) % sizeof (unsigned long) == 0)
+    {
+      while (size > 0 && (uintptr_t) dst % sizeof (unsigned long) != 0)
+        {
+          *dst++ = *src++;
+          size--;
+        }
+      for (; size >= sizeof (unsigned long); size -= sizeof (unsigned long))
+        {
+          *(unsigned long *) dst = *(const unsigned long *) src;
+          dst += sizeof (unsigned long);
+          src += sizeof (unsigned long);
+        }
+    }
+
   while (size-- > 0)
     *dst++ = *src++;
 
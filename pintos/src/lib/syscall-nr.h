@@ -29,7 +29,12 @@ enum
     SYS_MKDIR,                  /* Create a directory. */
     SYS_READDIR,                /* Reads a directory entry. */
     SYS_ISDIR,                  /* Tests if a fd represents a directory. */
-    SYS_INUMBER                 /* Returns the inode number for a fd. */
+    SYS_INUMBER,                /* Returns the inode number for a fd. */
+    SYS_FSYNC,                  /* Writes a file's changes to disk. */
+    SYS_SYNC,                   /* Writes all changes to disk. */
+    SYS_GETDENTS,               /* Reads many directory entries. */
+    SYS_STAT,                   /* Obtains information about a file. */
+    SYS_FSTAT                   /* Obtains information about a fd. */
   };
 
 #endif /* lib/syscall-nr.h */
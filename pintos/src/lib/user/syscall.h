@@ -4,6 +4,8 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <debug.h>
+#include <dirent.h>
+#include <stat.h>
 
 /* Process identifier. */
 typedef int pid_t;
@@ -46,6 +48,11 @@ bool mkdir (const char *dir);
 bool readdir (int fd, char name[READDIR_MAX_LEN + 1]);
 bool isdir (int fd);
 int inumber (int fd);
+bool fsync (int fd);
+void sync (void);
+int getdents (int fd, struct dirent *entries, unsigned cnt);
+bool stat (const char *file, struct stat *);
+bool fstat (int fd, struct stat *);
 
 /* Homework 5, Part B. */
 void* sbrk (intptr_t increment);
@@ -0,0 +1,118 @@
+/* Benchmark for the bitmap search functions in lib/kernel/bitmap.c.
+
+   Builds a large bitmap that is mostly set, with free bits
+   scattered through it the way they are in the free map of a
+   well-used disk, then times bitmap_scan() for runs of several
+   lengths and bitmap_count() over the whole map.  Each result is
+   checked against a bit-at-a-time search of the same map, as are
+   searches by bitmap_scan_range() limited to RANGE_BITS bits.
+
+   This is not a test we will run on your submitted projects.
+   It is here for completeness.
+*/
+
+#undef NDEBUG
+#include <bitmap.h>
+#include <debug.h>
+#include <inttypes.h>
+#include <random.h>
+#include <stdio.h>
+#include "devices/timer.h"
+#include "threads/test.h"
+
+/* Number of bits in the bitmap. */
+#define BIT_CNT (1024 * 1024)
+
+/* Out of every 100 bits, about this many are set. */
+#define FULL_PCT 90
+
+/* Searches timed per run length. */
+#define SCAN_CNT 16
+
+/* Bits searched by each bitmap_scan_range() check. */
+#define RANGE_BITS 100
+
+/* Returns the start of the first run of CNT false bits in B at
+   or after START, examining one bit at a time. */
+static size_t
+slow_scan (const struct bitmap *b, size_t start, size_t cnt)
+{
+  size_t run = 0;
+  size_t i;
+
+  for (i = start; i < bitmap_size (b); i++)
+    if (bitmap_test (b, i))
+      run = 0;
+    else if (++run == cnt)
+      return i + 1 - cnt;
+  return BITMAP_ERROR;
+}
+
+void
+test (void)
+{
+  static const size_t run_lengths[] = {1, 2, 4, 8, 16, 32};
+  struct bitmap *b;
+  size_t true_cnt;
+  int64_t start;
+  size_t i;
+
+  printf ("testing bitmap search:\n");
+  b = bitmap_create (BIT_CNT);
+  ASSERT (b != NULL);
+
+  /* Mark runs of random length until FULL_PCT of the bits are
+     set, leaving short gaps between them. */
+  random_init (0);
+  true_cnt = 0;
+  for (i = 0; i < BIT_CNT; )
+    {
+      size_t len = random_ulong () % 64 + 1;
+      if (len > BIT_CNT - i)
+        len = BIT_CNT - i;
+      if (random_ulong () % 100 < FULL_PCT)
+        {
+          bitmap_set_multiple (b, i, len, true);
+          true_cnt += len;
+        }
+      i += len;
+    }
+
+  start = timer_ticks ();
+  ASSERT (bitmap_count (b, 0, BIT_CNT, true) == true_cnt);
+  printf ("  count %d bits: %"PRId64" ticks\n",
+          BIT_CNT, timer_elapsed (start));
+
+  for (i = 0; i < sizeof run_lengths / sizeof *run_lengths; i++)
+    {
+      size_t cnt = run_lengths[i];
+      size_t found[SCAN_CNT];
+      size_t from;
+      int j;
+
+      /* Time a series of searches, each starting after the run
+         the last one found, then check them. */
+      start = timer_ticks ();
+      for (j = 0, from = 0; j < SCAN_CNT; j++)
+        {
+          found[j] = bitmap_scan (b, from, cnt, false);
+          from = found[j] != BITMAP_ERROR ? found[j] + cnt : 0;
+        }
+      printf ("  scan for %2zu free bits: %"PRId64" ticks\n",
+              cnt, timer_elapsed (start));
+
+      for (j = 0, from = 0; j < SCAN_CNT; j++)
+        {
+          size_t end = from + RANGE_BITS < BIT_CNT ? from + RANGE_BITS : BIT_CNT;
+          size_t in_range = (found[j] != BITMAP_ERROR && found[j] + cnt <= end
+                             ? found[j] : BITMAP_ERROR);
+
+          ASSERT (found[j] == slow_scan (b, from, cnt));
+          ASSERT (bitmap_scan_range (b, from, end, cnt, false) == in_range);
+          from = found[j] != BITMAP_ERROR ? found[j] + cnt : 0;
+        }
+    }
+
+  bitmap_destroy (b);
+  printf ("bitmap: PASS\n");
+}
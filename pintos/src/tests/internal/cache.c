@@ -0,0 +1,51 @@
+/* Benchmark for the buffer cache in filesys/cache.c.
+
+   Fills the cache with working sets of increasing size and
+   times repeated hits on them.  With an indexed cache the cost
+   of a hit should not depend on how many sectors are cached.
+   Working sets are kept to half the cache so that sectors
+   mapping unevenly onto partitions still all hit.  Boot with a
+   larger "-cache" to extend the range measured.
+
+   Must run after filesys_init().
+
+   This is not a test we will run on your submitted projects.
+   It is here for completeness.
+*/
+
+#undef NDEBUG
+#include <debug.h>
+#include <random.h>
+#include <stdio.h>
+#include "devices/timer.h"
+#include "filesys/cache.h"
+#include "threads/test.h"
+
+/* Hits timed per working-set size. */
+#define HIT_CNT 200000
+
+/* Times HIT_CNT cache hits spread over SET_SIZE sectors. */
+void
+test (void)
+{
+  static char buffer[BLOCK_SECTOR_SIZE];
+  size_t set_size;
+
+  printf ("testing cache hit latency:\n");
+  for (set_size = 1; set_size <= cache_size / 2; set_size *= 2)
+    {
+      int64_t start;
+      size_t i;
+
+      /* Bring the working set into the cache. */
+      for (i = 0; i < set_size; i++)
+        cache_read (i, buffer);
+
+      start = timer_ticks ();
+      for (i = 0; i < HIT_CNT; i++)
+        cache_read (random_ulong () % set_size, buffer);
+      printf ("  %3zu sectors: %"PRId64" ticks for %d hits\n",
+              set_size, timer_elapsed (start), HIT_CNT);
+    }
+  printf ("cache: PASS\n");
+}
@@ -0,0 +1,86 @@
+/* Benchmark for directory lookups in filesys/directory.c.
+
+   Creates ENTRY_CNT files in one directory, reporting the time
+   taken by each step of ENTRY_CNT / STEP_CNT creates, then looks
+   every name up and removes it.  With hashed directories the cost
+   of a create or lookup should not grow with the number of names
+   already in the directory.
+
+   Must run after filesys_init(), on a disk with room for
+   ENTRY_CNT inodes.
+
+   This is not a test we will run on your submitted projects.
+   It is here for completeness.
+*/
+
+#undef NDEBUG
+#include <debug.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include "devices/timer.h"
+#include "filesys/file.h"
+#include "filesys/filesys.h"
+#include "threads/test.h"
+
+/* Number of names created in the directory. */
+#define ENTRY_CNT 10000
+
+/* Number of steps the creates are timed in. */
+#define STEP_CNT 5
+
+static void
+file_name (char name[32], int i)
+{
+  snprintf (name, 32, "/dirbench/f%d", i);
+}
+
+void
+test (void)
+{
+  char name[32];
+  int64_t start, ticks;
+  bool isdir;
+  int i;
+
+  printf ("testing directory with %d entries:\n", ENTRY_CNT);
+  ASSERT (filesys_create ("/dirbench", 16, true));
+
+  for (i = 0; i < ENTRY_CNT; i += ENTRY_CNT / STEP_CNT)
+    {
+      int j;
+
+      start = timer_ticks ();
+      for (j = i; j < i + ENTRY_CNT / STEP_CNT; j++)
+        {
+          file_name (name, j);
+          ASSERT (filesys_create (name, 0, false));
+        }
+      ticks = timer_elapsed (start);
+      printf ("  creates %d to %d: %"PRId64" ticks\n",
+              i, i + ENTRY_CNT / STEP_CNT - 1, ticks);
+    }
+
+  start = timer_ticks ();
+  for (i = 0; i < ENTRY_CNT; i++)
+    {
+      struct file *file;
+
+      file_name (name, i);
+      file = filesys_open (name, &isdir);
+      ASSERT (file != NULL && !isdir);
+      file_close (file);
+    }
+  ticks = timer_elapsed (start);
+  printf ("  %d lookups: %"PRId64" ticks", ENTRY_CNT, ticks);
+  if (ticks > 0)
+    printf (", %"PRId64" lookups/s", (int64_t) ENTRY_CNT * TIMER_FREQ / ticks);
+  printf ("\n");
+
+  for (i = 0; i < ENTRY_CNT; i++)
+    {
+      file_name (name, i);
+      ASSERT (filesys_remove (name));
+    }
+  ASSERT (filesys_remove ("/dirbench"));
+  printf ("dir: PASS\n");
+}
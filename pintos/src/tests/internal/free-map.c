@@ -0,0 +1,69 @@
+/* Benchmark for file growth in filesys/inode.c and
+   filesys/free-map.c.
+
+   Repeats what the lg-create and lg-full tests do to the file
+   system, then grows a file to 1 MB, timing each step.  The free
+   map statistics printed afterward show how many times the free
+   map was written back, which should be about once per resize
+   rather than once per sector.
+
+   Must run after filesys_init().
+
+   This is not a test we will run on your submitted projects.
+   It is here for completeness.
+*/
+
+#undef NDEBUG
+#include <debug.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include "devices/timer.h"
+#include "filesys/file.h"
+#include "filesys/filesys.h"
+#include "filesys/free-map.h"
+#include "threads/malloc.h"
+#include "threads/test.h"
+
+/* Size of the files created by lg-create and lg-full. */
+#define LG_SIZE 75678
+
+/* Size of the file grown in the last step. */
+#define BIG_SIZE (1024 * 1024)
+
+/* Data written to the files, BIG_SIZE bytes.  Allocated by
+   test() rather than static, so as not to add 1 MB to the
+   kernel's BSS. */
+static char *buffer;
+
+static void
+time_create (const char *name, off_t size, bool fill)
+{
+  bool isdir;
+  int64_t start = timer_ticks ();
+  ASSERT (filesys_create (name, fill ? 0 : size, false));
+  if (fill)
+    {
+      struct file *file = filesys_open (name, &isdir);
+      ASSERT (file != NULL && !isdir);
+      ASSERT (file_write (file, buffer, size) == size);
+      file_close (file);
+    }
+  printf ("  %-8s %7"PRId32" bytes: %"PRId64" ticks\n",
+          name, size, timer_elapsed (start));
+  ASSERT (filesys_remove (name));
+}
+
+void
+test (void)
+{
+  buffer = calloc (1, BIG_SIZE);
+  ASSERT (buffer != NULL);
+
+  printf ("testing file growth:\n");
+  time_create ("create", LG_SIZE, false);
+  time_create ("full", LG_SIZE, true);
+  time_create ("big", BIG_SIZE, true);
+  free_map_print_stats ();
+  free (buffer);
+  printf ("free-map: PASS\n");
+}
@@ -0,0 +1,111 @@
+/* Stress test for the open inode table in filesys/inode.c.
+
+   Creates FILE_CNT files and keeps them all open, so the table is
+   large, then has THREAD_CNT threads repeatedly open and close
+   files chosen at random and reports opens per second.  Each open
+   must find the inode already held open, so every lookup goes
+   through the table.
+
+   Must run after filesys_init().
+
+   This is not a test we will run on your submitted projects.
+   It is here for completeness.
+*/
+
+#undef NDEBUG
+#include <debug.h>
+#include <inttypes.h>
+#include <random.h>
+#include <stdio.h>
+#include "devices/timer.h"
+#include "filesys/file.h"
+#include "filesys/filesys.h"
+#include "filesys/inode.h"
+#include "threads/synch.h"
+#include "threads/test.h"
+#include "threads/thread.h"
+
+/* Number of files created and held open. */
+#define FILE_CNT 2000
+
+/* Number of threads opening files at once. */
+#define THREAD_CNT 8
+
+/* Opens done by each thread. */
+#define OPEN_CNT 5000
+
+static struct file *held[FILE_CNT];
+static struct semaphore done;
+
+static void
+file_name (char name[16], int i)
+{
+  snprintf (name, 16, "/inode%d", i);
+}
+
+/* Opens and closes OPEN_CNT random files, checking that each open
+   returns the inode already held open. */
+static void
+open_thread (void *seed_)
+{
+  unsigned seed = (unsigned) seed_;
+  char name[16];
+  bool isdir;
+  int i;
+
+  for (i = 0; i < OPEN_CNT; i++)
+    {
+      int idx;
+      struct file *file;
+
+      seed = seed * 1103515245 + 12345;
+      idx = (seed >> 8) % FILE_CNT;
+      file_name (name, idx);
+      file = filesys_open (name, &isdir);
+      ASSERT (file != NULL && !isdir);
+      ASSERT (file_get_inode (file) == file_get_inode (held[idx]));
+      file_close (file);
+    }
+  sema_up (&done);
+}
+
+void
+test (void)
+{
+  char name[16];
+  int64_t start, ticks;
+  bool isdir;
+  int i;
+
+  printf ("testing open inode table with %d files open:\n", FILE_CNT);
+  for (i = 0; i < FILE_CNT; i++)
+    {
+      file_name (name, i);
+      ASSERT (filesys_create (name, 0, false));
+      held[i] = filesys_open (name, &isdir);
+      ASSERT (held[i] != NULL && !isdir);
+    }
+
+  sema_init (&done, 0);
+  start = timer_ticks ();
+  for (i = 0; i < THREAD_CNT; i++)
+    thread_create ("opener", PRI_DEFAULT, open_thread, (void *) (i + 1));
+  for (i = 0; i < THREAD_CNT; i++)
+    sema_down (&done);
+  ticks = timer_elapsed (start);
+
+  printf ("  %d opens by %d threads: %"PRId64" ticks",
+          THREAD_CNT * OPEN_CNT, THREAD_CNT, ticks);
+  if (ticks > 0)
+    printf (", %"PRId64" opens/s",
+            (int64_t) THREAD_CNT * OPEN_CNT * TIMER_FREQ / ticks);
+  printf ("\n");
+
+  for (i = 0; i < FILE_CNT; i++)
+    {
+      file_close (held[i]);
+      file_name (name, i);
+      ASSERT (filesys_remove (name));
+    }
+  printf ("inode: PASS\n");
+}
@@ -0,0 +1,96 @@
+/* Test for reading a directory in filesys/directory.c while it
+   grows.
+
+   Creates OLD_CNT files in a directory, then reads the directory
+   with dir_readdir(), creating NEW_PER_READ more files after each
+   name read.  That splits buckets behind and ahead of the
+   directory's position.  Every file that existed before the reads
+   began must be read exactly once, and no name may be read twice.
+
+   Must run after filesys_init().
+
+   This is not a test we will run on your submitted projects.
+   It is here for completeness.
+*/
+
+#undef NDEBUG
+#include <debug.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "filesys/directory.h"
+#include "filesys/filesys.h"
+#include "threads/test.h"
+
+/* Files in the directory before it is read. */
+#define OLD_CNT 200
+
+/* Files created after each name is read, and most in all. */
+#define NEW_PER_READ 5
+#define NEW_MAX 2000
+
+static void
+remove_all (char prefix, int cnt)
+{
+  char name[32];
+  int i;
+
+  for (i = 0; i < cnt; i++)
+    {
+      snprintf (name, sizeof name, "/readdir/%c%d", prefix, i);
+      ASSERT (filesys_remove (name));
+    }
+}
+
+void
+test (void)
+{
+  static bool seen_old[OLD_CNT], seen_new[NEW_MAX];
+  char name[32];
+  struct dir *dir;
+  bool isdir;
+  int new_cnt = 0;
+  int i;
+
+  printf ("testing readdir of a directory split while read:\n");
+  ASSERT (filesys_create ("/readdir", 16, true));
+  for (i = 0; i < OLD_CNT; i++)
+    {
+      snprintf (name, sizeof name, "/readdir/o%d", i);
+      ASSERT (filesys_create (name, 0, false));
+    }
+
+  dir = filesys_open ("/readdir", &isdir);
+  ASSERT (dir != NULL && isdir);
+  while (dir_readdir (dir, name))
+    {
+      int idx = atoi (name + 1);
+
+      if (name[0] == 'o')
+        {
+          ASSERT (idx < OLD_CNT && !seen_old[idx]);
+          seen_old[idx] = true;
+        }
+      else
+        {
+          ASSERT (name[0] == 'n' && idx < NEW_MAX && !seen_new[idx]);
+          seen_new[idx] = true;
+        }
+
+      for (i = 0; i < NEW_PER_READ && new_cnt < NEW_MAX; i++, new_cnt++)
+        {
+          snprintf (name, sizeof name, "/readdir/n%d", new_cnt);
+          ASSERT (filesys_create (name, 0, false));
+        }
+    }
+  dir_close (dir);
+
+  for (i = 0; i < OLD_CNT; i++)
+    ASSERT (seen_old[i]);
+  printf ("  read %d old names once each, %d files created\n",
+          OLD_CNT, new_cnt);
+
+  remove_all ('o', OLD_CNT);
+  remove_all ('n', new_cnt);
+  ASSERT (filesys_remove ("/readdir"));
+  printf ("readdir: PASS\n");
+}
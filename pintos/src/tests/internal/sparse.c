@@ -0,0 +1,124 @@
+/* Test for filling holes in files in filesys/inode.c.
+
+   Writes past the end of FILE_CNT files, leaving a hole that
+   reaches through the indirect and doubly indirect ranges, then
+   fills sectors of each hole and reads them back.  The sectors
+   filled include the first one mapped by each pointer block, so
+   finding the sector before them reads a different pointer
+   block.  Between fills a scratch file is read through the cache
+   to push those pointer blocks out.  Boot with a small "-cache",
+   such as "-cache=16", so that they miss and the cache has to
+   choose a victim while the hole is being filled.
+
+   Must run after filesys_init().
+
+   This is not a test we will run on your submitted projects.
+   It is here for completeness.
+*/
+
+#undef NDEBUG
+#include <debug.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/block.h"
+#include "filesys/file.h"
+#include "filesys/filesys.h"
+#include "threads/malloc.h"
+#include "threads/test.h"
+
+/* Number of sparse files written. */
+#define FILE_CNT 100
+
+/* File sector each sparse file is first written at. */
+#define END_SECTOR 700
+
+/* Sectors in the scratch file read between fills. */
+#define SCRATCH_SECTORS 40
+
+/* File sectors filled in each sparse file: the first sectors
+   mapped by the indirect block and by the doubly indirect block,
+   the first sector mapped by each of its first four second level
+   blocks, and one sector in the middle of a second level block. */
+static const int fill_sectors[] = {123, 251, 379, 507, 635, 400};
+
+static void
+fill (uint8_t *buf, int seed)
+{
+  int i;
+
+  for (i = 0; i < BLOCK_SECTOR_SIZE; i++)
+    buf[i] = i * 7 + seed;
+}
+
+/* Reads the whole scratch file, evicting other sectors. */
+static void
+thrash (uint8_t *scratch)
+{
+  bool isdir;
+  struct file *file = filesys_open ("/scratch", &isdir);
+
+  ASSERT (file != NULL && !isdir);
+  ASSERT (file_read_at (file, scratch, SCRATCH_SECTORS * BLOCK_SECTOR_SIZE, 0)
+          == SCRATCH_SECTORS * BLOCK_SECTOR_SIZE);
+  file_close (file);
+}
+
+void
+test (void)
+{
+  uint8_t *scratch = malloc (SCRATCH_SECTORS * BLOCK_SECTOR_SIZE);
+  uint8_t *buf = malloc (BLOCK_SECTOR_SIZE);
+  uint8_t *back = malloc (BLOCK_SECTOR_SIZE);
+  struct file *file;
+  char name[16];
+  bool isdir;
+  int i, j;
+
+  ASSERT (scratch != NULL && buf != NULL && back != NULL);
+
+  printf ("testing filling holes in %d files:\n", FILE_CNT);
+  memset (scratch, 0x5a, SCRATCH_SECTORS * BLOCK_SECTOR_SIZE);
+  ASSERT (filesys_create ("/scratch", 0, false));
+  file = filesys_open ("/scratch", &isdir);
+  ASSERT (file != NULL && !isdir);
+  ASSERT (file_write (file, scratch, SCRATCH_SECTORS * BLOCK_SECTOR_SIZE)
+          == SCRATCH_SECTORS * BLOCK_SECTOR_SIZE);
+  file_close (file);
+
+  for (i = 0; i < FILE_CNT; i++)
+    {
+      snprintf (name, sizeof name, "/sparse%d", i);
+      ASSERT (filesys_create (name, 0, false));
+      file = filesys_open (name, &isdir);
+      ASSERT (file != NULL && !isdir);
+      file_seek (file, END_SECTOR * BLOCK_SECTOR_SIZE);
+      ASSERT (file_write (file, "end", 3) == 3);
+
+      for (j = 0; j < (int) (sizeof fill_sectors / sizeof *fill_sectors); j++)
+        {
+          off_t ofs = fill_sectors[j] * BLOCK_SECTOR_SIZE;
+
+          thrash (scratch);
+          fill (buf, i + j);
+          ASSERT (file_write_at (file, buf, BLOCK_SECTOR_SIZE, ofs)
+                  == BLOCK_SECTOR_SIZE);
+          ASSERT (file_read_at (file, back, BLOCK_SECTOR_SIZE, ofs)
+                  == BLOCK_SECTOR_SIZE);
+          ASSERT (!memcmp (buf, back, BLOCK_SECTOR_SIZE));
+        }
+
+      /* Sectors still in the hole read as zeros. */
+      ASSERT (file_read_at (file, back, BLOCK_SECTOR_SIZE,
+                            300 * BLOCK_SECTOR_SIZE) == BLOCK_SECTOR_SIZE);
+      for (j = 0; j < BLOCK_SECTOR_SIZE; j++)
+        ASSERT (back[j] == 0);
+      file_close (file);
+      ASSERT (filesys_remove (name));
+    }
+
+  ASSERT (filesys_remove ("/scratch"));
+  free (scratch);
+  free (buf);
+  free (back);
+  printf ("sparse: PASS\n");
+}
@@ -515,6 +515,7 @@ init_thread (struct thread *t, const char *name, int priority)
   t->priority = priority;
   t->magic = THREAD_MAGIC;
   t->cwd = NULL;
+  t->journal_depth = 0;
   
   list_init (&t->children);
   list_init (&t->fd_map);
@@ -121,6 +121,11 @@ struct thread
 
     struct list fd_map;
 
+    /* Owned by filesys/journal.c. */
+    int journal_depth;                  /* Nesting of open journal handles. */
+    size_t journal_credits;             /* Sectors reserved by the outermost
+                                           handle. */
+
 #ifdef USERPROG
     /* Owned by userprog/process.c. */
     uint32_t *pagedir;                  /* Page directory. */
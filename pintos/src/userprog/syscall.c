@@ -1,6 +1,8 @@
 #include "userprog/syscall.h"
 #include "userprog/pagedir.h"
 #include "devices/shutdown.h"
+#include <dirent.h>
+#include <stat.h>
 #include <stdio.h>
 #include <syscall-nr.h>
 #include "threads/interrupt.h"
@@ -32,6 +34,28 @@ bool is_valid_args(uint32_t *args, int number_args) {
   return (pd_beginning != NULL && pd_end != NULL);
 }
 
+/* Returns true if all SIZE bytes at BUFFER are mapped user
+   memory. */
+static bool
+is_valid_buffer(void *buffer, size_t size) {
+  uint32_t *active_pd = thread_current()->pagedir;
+  char *p = pg_round_down(buffer);
+  char *end = (char *) buffer + size;
+
+  if (size == 0) {
+    return true;
+  }
+  if (end < (char *) buffer || !is_user_vaddr(end - 1)) {
+    return false;
+  }
+  for (; p < end; p += PGSIZE) {
+    if (pagedir_get_page(active_pd, p) == NULL) {
+      return false;
+    }
+  }
+  return true;
+}
+
 static 
 bool is_valid_file(const char *file) {
   // returns whether the file is valid or not
@@ -238,6 +262,78 @@ static int inumber(int fd) {
   return -1;
 }
 
+static bool
+fsync(int fd) {
+  struct dir *dir_ = get_dir_from_fd(fd);
+  if (dir_ != NULL) {
+    inode_sync(dir_get_inode(dir_));
+    return true;
+  }
+  struct file *file_ = get_file_from_fd(fd);
+  if (file_ != NULL) {
+    file_sync(file_);
+    return true;
+  }
+  return false;
+}
+
+/* Stores up to CNT entries of directory FD in ENTRIES.  Returns the
+   number stored, 0 at the end of the directory, or -1 if FD is not
+   a directory. */
+static int
+getdents(int fd, struct dirent *entries, unsigned cnt) {
+  struct dir *dir_ = get_dir_from_fd(fd);
+  if (dir_ == NULL) {
+    return -1;
+  }
+  if (cnt > INT32_MAX / sizeof *entries
+      || !is_valid_buffer(entries, cnt * sizeof *entries)) {
+    exit_file_call(-1);
+  }
+  return dir_readdir_batch(dir_, entries, cnt);
+}
+
+/* Stores information about FILE in ST.  Returns false if FILE does
+   not exist. */
+static bool
+stat(const char *file, struct stat *st) {
+  struct stat kst;
+  if (!is_valid_file(file) || !is_valid_buffer(st, sizeof *st)) {
+    exit_file_call(-1);
+  }
+  if (!filesys_stat(file, &kst)) {
+    return false;
+  }
+  *st = kst;
+  return true;
+}
+
+/* Stores information about the file or directory open as FD in ST.
+   Returns false if FD is not open. */
+static bool
+fstat(int fd, struct stat *st) {
+  struct inode *inode = NULL;
+  struct stat kst;
+  if (!is_valid_buffer(st, sizeof *st)) {
+    exit_file_call(-1);
+  }
+  struct dir *dir_ = get_dir_from_fd(fd);
+  if (dir_ != NULL) {
+    inode = dir_get_inode(dir_);
+  } else {
+    struct file *file_ = get_file_from_fd(fd);
+    if (file_ != NULL) {
+      inode = file_get_inode(file_);
+    }
+  }
+  if (inode == NULL) {
+    return false;
+  }
+  inode_stat(inode, &kst);
+  *st = kst;
+  return true;
+}
+
 void
 close_thread_fd(thread_fd_t *fd) {
   close(fd->fd);
@@ -369,7 +465,39 @@ file_operation_handler(struct intr_frame *f) {
       f->eax = inumber(fd);
       // printf("fd: %d is inumber: %d\n", fd, f->eax);
       break;
-    }
+    }                 /* Returns the inode number for a fd. */
+    case SYS_FSYNC: {
+      if (!is_valid_args(args, 2)) {
+        exit_file_call(-1);
+      }
+      f->eax = fsync((int) args[1]);
+      break;
+    }                 /* Writes a file's changes to disk. */
+    case SYS_SYNC:
+      filesys_sync();
+      break;          /* Writes all changes to disk. */
+    case SYS_GETDENTS: {
+      if (!is_valid_args(args, 4)) {
+        exit_file_call(-1);
+      }
+      f->eax = getdents((int) args[1], (struct dirent *) args[2],
+                        (unsigned) args[3]);
+      break;
+    }                 /* Reads many directory entries. */
+    case SYS_STAT: {
+      if (!is_valid_args(args, 3)) {
+        exit_file_call(-1);
+      }
+      f->eax = stat((const char *) args[1], (struct stat *) args[2]);
+      break;
+    }                 /* Obtains information about a file. */
+    case SYS_FSTAT: {
+      if (!is_valid_args(args, 3)) {
+        exit_file_call(-1);
+      }
+      f->eax = fstat((int) args[1], (struct stat *) args[2]);
+      break;
+    }                 /* Obtains information about a fd. */
   }
 }
 